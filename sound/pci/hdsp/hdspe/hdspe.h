@@ -426,6 +426,23 @@ struct hdspe_peak_rms {
 #define SNDRV_HDSPE_IOCTL_GET_PEAK_RMS \
 	_IOR('H', 0x42, struct hdspe_peak_rms)
 
+/* The driver reads the level meters at most once every "Meter Update
+ * Interval" ms, and serves all clients from the same snapshot. The
+ * snapshot is also available on a read-only page, mapped with mmap() on
+ * the hwdep device at offset HDSPE_MMAP_OFFSET_METERS. The page is kept
+ * up to date while mapped. Readers synchronize with seq as for struct
+ * hdspe_status_page below. */
+#define HDSPE_MMAP_OFFSET_METERS 0x10000
+
+struct hdspe_meter_page {
+	uint32_t version;        /* HDSPE_VERSION */
+	uint32_t seq;            /* odd while the driver is updating */
+	int64_t  time;           /* snapshot time, ns CLOCK_MONOTONIC */
+	uint32_t interval_ms;    /* snapshot interval */
+	uint32_t reserved;
+	struct hdspe_peak_rms levels;
+};
+
 /* ------------ CONFIG block IOCTL ---------------------- */
 
 struct hdspe_config {
@@ -567,6 +584,22 @@ enum hdspe_wck_conversion {
 	 i == HDSPE_WCK_CONVERSION_48_44_1 ? "48 KHz -> 44.1 KHz" :	\
 	 "???")
 
+/* PCM pointer mode: how the PCM .pointer callback determines the
+ * hardware position in between period interrupts. */
+enum hdspe_pointer_mode {
+	HDSPE_POINTER_MODE_PERIOD       =0, /* latched at last interrupt */
+	HDSPE_POINTER_MODE_LIVE         =1, /* read hardware pointer */
+	HDSPE_POINTER_MODE_INTERPOLATED =2, /* extrapolate from last irq */
+	HDSPE_POINTER_MODE_COUNT        =3,
+	HDSPE_POINTER_MODE_FORCE_32BIT  =0xffffffff
+};
+
+#define HDSPE_POINTER_MODE_NAME(i)				\
+	(i == HDSPE_POINTER_MODE_PERIOD       ? "Period" :	\
+	 i == HDSPE_POINTER_MODE_LIVE         ? "Live" :	\
+	 i == HDSPE_POINTER_MODE_INTERPOLATED ? "Interpolated" :	\
+	 "???")
+
 #ifdef NEVER
 #pragma scalar_storage_order little-endian
 
@@ -862,6 +895,157 @@ struct hdspe_card_info {
 	_IOR('H', 0x45, struct hdspe_status)
 
 
+/* ------------- Sample clock estimate --------------- */
+
+/* Actual sample clock relative to CLOCK_MONOTONIC_RAW, as estimated by
+ * a delay locked loop fed with the time stamps of the audio period
+ * interrupts. The time of frame position p is estimated as
+ * frame_time + (p - frame_pos) * frame_ns_q32 / 2^32 nanoseconds. */
+struct hdspe_clock_estimate {
+	uint64_t frame_pos;      /* frame position of last period boundary */
+	int64_t  frame_time;     /* its filtered time, ns CLOCK_MONOTONIC_RAW */
+	uint64_t frame_ns_q32;   /* filtered frame duration, ns * 2^32 */
+	uint64_t rate_uhz;       /* filtered sample rate, in micro-Hz */
+	int64_t  phase_error;    /* last time stamp minus prediction, ns */
+	uint32_t jitter;         /* average absolute phase error, ns */
+	uint32_t locked;         /* 1 if the loop has settled, 0 if not */
+	uint64_t updates;        /* periods since the loop was (re)started */
+};
+
+#define SNDRV_HDSPE_IOCTL_GET_CLOCK_ESTIMATE \
+	_IOR('H', 0x4a, struct hdspe_clock_estimate)
+
+/* The card sample clock is also available as a POSIX dynamic clock, on
+ * character device /dev/hdspe-clock<card number>: clock_gettime() on
+ * FD_TO_CLOCKID(fd) returns the frame position, interpolated in between
+ * period interrupts using the sample clock estimate, converted to time
+ * at the nominal sample rate. The following ioctl, on the clock device
+ * as well as on the hwdep device, cross time stamps the card sample clock
+ * and the system clocks. All times are in ns. */
+struct hdspe_clock_crosststamp {
+	int64_t card;            /* card sample clock */
+	int64_t monotonic_raw;   /* CLOCK_MONOTONIC_RAW, read first */
+	int64_t monotonic;       /* CLOCK_MONOTONIC, read next */
+	int64_t realtime;        /* CLOCK_REALTIME, read last */
+	uint32_t rate;           /* nominal sample rate */
+	uint32_t locked;         /* 1 if the sample clock estimate is locked */
+};
+
+#define SNDRV_HDSPE_IOCTL_GET_CLOCK_CROSSTSTAMP \
+	_IOR('H', 0x4b, struct hdspe_clock_crosststamp)
+
+
+/* ------------- Status page --------------- */
+
+/* Read-only page, mapped with mmap() on the hwdep device at offset
+ * HDSPE_MMAP_OFFSET_STATUS, kept up to date by the driver. Readers
+ * take a consistent snapshot without system calls as follows:
+ *
+ * do {
+ *	while ((seq = READ_ONCE(page->seq)) & 1)
+ *		;                            // update in progress
+ *	smp_rmb();
+ *	snapshot = *page;
+ *	smp_rmb();
+ * } while (READ_ONCE(page->seq) != seq);
+ *
+ * The period fields are updated at each audio period interrupt. The
+ * status fields are updated by the driver status worker, whenever the
+ * driver detects a status change, and at least HDSPE_STATUS_PAGE_RATE
+ * times per second while the page is mapped. */
+#define HDSPE_MMAP_OFFSET_STATUS 0
+#define HDSPE_STATUS_PAGE_RATE   10
+
+struct hdspe_status_page {
+	uint32_t version;        /* HDSPE_VERSION */
+	uint32_t seq;            /* odd while the driver is updating */
+
+	/* Period interrupt state */
+	uint64_t frame_count;    /* frame counter at last period interrupt */
+	int64_t  irq_time;       /* its time stamp, ns CLOCK_MONOTONIC */
+	int64_t  irq_time_raw;   /* idem, ns CLOCK_MONOTONIC_RAW */
+	uint32_t buf_ptr;        /* hardware buffer pointer, in frames */
+	uint32_t running;        /* bit 0: playback, bit 1: capture running */
+	uint32_t ltc_in;         /* TCO incoming LTC (0 if no TCO) */
+	uint32_t reserved0;
+	uint64_t ltc_in_frame_count; /* frame count at start of ltc_in */
+
+	/* Status, as with SNDRV_HDSPE_IOCTL_GET_STATUS */
+	int64_t  status_time;    /* time of last update, ns CLOCK_MONOTONIC */
+	uint64_t sample_rate_numerator;
+	uint32_t sample_rate_denominator;
+	uint32_t internal_sample_rate_denominator;
+	uint32_t clock_mode;     /* enum hdspe_clock_mode */
+	uint32_t internal_freq;  /* enum hdspe_freq */
+	uint32_t preferred_ref;  /* enum hdspe_clock_source */
+	uint32_t autosync_ref;   /* enum hdspe_clock_source */
+	uint32_t external_freq;  /* enum hdspe_freq */
+	uint32_t speed_mode;     /* enum hdspe_speed */
+	uint32_t sync[HDSPE_CLOCK_SOURCE_COUNT]; /* enum hdspe_sync_status */
+	uint32_t freq[HDSPE_CLOCK_SOURCE_COUNT]; /* enum hdspe_freq */
+};
+
+
+/* ------------- Event stream --------------- */
+
+/* read() on the hwdep device returns a stream of struct hdspe_event
+ * records, as many as fit in the buffer, blocking until at least one
+ * is available. poll() reports when events are pending. Each reader gets all events posted after it
+ * opened the device. A reader that falls more than
+ * HDSPE_EVENT_QUEUE_SIZE events behind gets an HDSPE_EVENT_OVERFLOW
+ * event with the number of lost events, followed by the oldest events
+ * still queued. */
+#define HDSPE_EVENT_QUEUE_SIZE 256
+
+enum hdspe_event_type {
+	HDSPE_EVENT_OVERFLOW    = 0,  /* events were lost */
+	HDSPE_EVENT_SYNC        = 1,  /* clock source sync status change */
+	HDSPE_EVENT_SAMPLE_RATE = 2,  /* system sample rate change */
+	HDSPE_EVENT_LTC         = 3,  /* new incoming LTC frame */
+	HDSPE_EVENT_XRUN        = 4,  /* hardware side dropout */
+	HDSPE_EVENT_RUNNING     = 5,  /* streams started or stopped */
+	HDSPE_EVENT_BUFFER_SIZE = 6,  /* period size change */
+	HDSPE_EVENT_TYPE_COUNT  = 7
+};
+
+struct hdspe_event {
+	uint32_t type;           /* enum hdspe_event_type */
+	uint32_t reserved;
+	uint64_t frame_count;    /* frame counter at last period interrupt */
+	int64_t  time;           /* event time, ns CLOCK_MONOTONIC */
+	union {
+		struct {
+			uint32_t lost;     /* number of lost events */
+		} overflow;
+		struct {
+			uint32_t source;   /* enum hdspe_clock_source */
+			uint32_t status;   /* enum hdspe_sync_status */
+			uint32_t freq;     /* enum hdspe_freq */
+		} sync;
+		struct {
+			uint64_t numerator;
+			uint32_t denominator;
+		} sample_rate;           /* as in struct hdspe_status */
+		struct {
+			uint64_t frame_count; /* frame count at start of LTC */
+			uint32_t ltc;      /* time code, as "LTC In" */
+		} ltc;
+		struct {
+			uint32_t stream;   /* 0: playback, 1: capture */
+			uint32_t missed;   /* total missed periods */
+			uint32_t late;     /* total late interrupts */
+		} xrun;
+		struct {
+			uint32_t running;  /* bit 0: playback, 1: capture */
+		} running;
+		struct {
+			uint32_t frames;   /* period size */
+		} buffer_size;
+		uint64_t data[3];
+	};
+};
+
+
 /* ------------- Matrix Mixer IOCTL --------------- */
 
 /* MADI mixer: 64inputs+64playback in 64outputs = 8192 => *4Byte =
@@ -897,6 +1081,148 @@ struct hdspe_mixer_ioctl {
 /* use indirect access due to the limit of ioctl bit size */
 #define SNDRV_HDSPE_IOCTL_GET_MIXER _IOR('H', 0x44, struct hdspe_mixer_ioctl)
 
+/* Bulk matrix mixer update. Sources 0..63 are inputs, 64..127 software
+ * playback channels, as for the "Mixer" control element. Gains range
+ * from 0 to 65535, with HDSPE_UNITY_GAIN at 0 dB. */
+struct hdspe_mixer_cell {
+	uint16_t destination;   /* output channel */
+	uint16_t source;        /* input, or 64 + playback channel */
+	uint32_t gain;
+};
+
+/* All faders of output channel destination */
+struct hdspe_mixer_row {
+	uint32_t destination;
+	struct hdspe_channelfader faders;
+};
+
+/* The cells and rows are checked before anything is changed: an invalid
+ * destination, source or gain fails the whole request with EINVAL. Only
+ * faders that change value are written to the hardware. Rows are applied
+ * before cells. Mixer control elements are notified once per request.
+ * Fails with EBUSY if playback and capture are used by different
+ * processes, like the mixer control elements.
+ * User space pointers in the structs below are passed as 64-bit
+ * integers, so 32-bit programs work with a 64-bit kernel. */
+struct hdspe_mixer_set {
+	uint32_t cell_count;                /* number of cells */
+	uint32_t row_count;                 /* number of rows */
+	uint64_t cells;                     /* struct hdspe_mixer_cell * */
+	uint64_t rows;                      /* struct hdspe_mixer_row * */
+	uint32_t changed;                   /* out: number of faders changed */
+	uint32_t reserved;
+};
+
+#define SNDRV_HDSPE_IOCTL_SET_MIXER \
+	_IOWR('H', 0x4c, struct hdspe_mixer_set)
+
+/* Mixer scenes: the driver keeps HDSPE_MIXER_SCENES named matrix mixer
+ * snapshots. */
+#define HDSPE_MIXER_SCENES          16
+#define HDSPE_MIXER_SCENE_NAME_LEN  32
+
+/* SNDRV_HDSPE_IOCTL_STORE_MIXER_SCENE stores mixer in scene index, or
+ * the current mixer if mixer is 0, replacing the scene stored there.
+ * Fails with EINVAL if a gain exceeds 65535.
+ * SNDRV_HDSPE_IOCTL_GET_MIXER_SCENE returns the name of scene index,
+ * and copies the scene to mixer if not 0. Fails with ENOENT if no
+ * scene is stored there. */
+struct hdspe_mixer_scene {
+	uint32_t index;                         /* 0 .. HDSPE_MIXER_SCENES-1 */
+	char name[HDSPE_MIXER_SCENE_NAME_LEN];  /* null terminated */
+	uint32_t reserved;
+	uint64_t mixer;                         /* struct hdspe_mixer * */
+};
+
+#define SNDRV_HDSPE_IOCTL_STORE_MIXER_SCENE \
+	_IOW('H', 0x4d, struct hdspe_mixer_scene)
+#define SNDRV_HDSPE_IOCTL_GET_MIXER_SCENE \
+	_IOWR('H', 0x4e, struct hdspe_mixer_scene)
+
+/* SNDRV_HDSPE_IOCTL_RECALL_MIXER_SCENE makes scene index the current
+ * mixer. Only faders that differ are written, all decreasing gains before
+ * all increasing ones, so no route is ever louder than in the old or the
+ * new mixer. All running gain ramps (SNDRV_HDSPE_IOCTL_RAMP_MIXER) are
+ * cancelled. Fails with ENOENT if no scene is stored at index, and with
+ * EBUSY like SNDRV_HDSPE_IOCTL_SET_MIXER. */
+struct hdspe_mixer_scene_recall {
+	uint32_t index;
+	uint32_t changed;       /* out: number of faders changed */
+	uint64_t duration;      /* out: time it took to apply, ns */
+};
+
+#define SNDRV_HDSPE_IOCTL_RECALL_MIXER_SCENE \
+	_IOWR('H', 0x4f, struct hdspe_mixer_scene_recall)
+
+/* Mixer gain ramps: the driver moves faders to the target gain over the
+ * given duration, one step per period, linearly in dB. A ramp replaces
+ * the ramp on the same fader, if any. A duration of 0 sets the gain
+ * immediately and cancels the ramp on that fader. A fader written during
+ * a ramp continues ramping from the written value. At most
+ * HDSPE_MIXER_RAMPS ramps run at the same time: if a request would
+ * exceed that, it fails with ENOSPC and nothing changes. */
+#define HDSPE_MIXER_RAMPS               256
+#define HDSPE_MIXER_RAMP_MAX_DURATION   60000   /* ms */
+
+struct hdspe_mixer_ramp {
+	uint16_t destination;   /* output channel */
+	uint16_t source;        /* input, or 64 + playback channel */
+	uint32_t gain;          /* target gain */
+	uint32_t duration;      /* ms */
+};
+
+struct hdspe_mixer_ramps {
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t ramps;         /* struct hdspe_mixer_ramp * */
+};
+
+#define SNDRV_HDSPE_IOCTL_RAMP_MIXER \
+	_IOW('H', 0x50, struct hdspe_mixer_ramps)
+
+/* ------------- Timed commands --------------- */
+
+/* Commands scheduled with SNDRV_HDSPE_IOCTL_SCHEDULE are carried out by
+ * the driver at the audio interrupt preceding the period that contains
+ * frame, the frame counter value of the command (see struct
+ * hdspe_status_page and struct hdspe_event). Commands due at the same
+ * frame are carried out in the order they were scheduled. Commands in
+ * the past are carried out at the next audio interrupt.
+ * At most HDSPE_SCHEDULE_SIZE commands can be pending: a request that
+ * would exceed that fails with ENOSPC, and nothing is scheduled. Invalid
+ * commands fail the whole request with EINVAL.
+ * SNDRV_HDSPE_IOCTL_CANCEL_SCHEDULE discards all pending commands.
+ * Both fail with EBUSY while another process has the card open. */
+#define HDSPE_SCHEDULE_SIZE 256
+
+enum hdspe_command_type {
+	HDSPE_COMMAND_MIXER = 0,    /* set a matrix mixer fader */
+	HDSPE_COMMAND_DDS = 1,      /* set the DDS value, see "DDS" control */
+};
+
+struct hdspe_command {
+	uint64_t frame;             /* frame counter value */
+	uint32_t type;              /* enum hdspe_command_type */
+	uint32_t reserved;
+	union {
+		struct hdspe_mixer_cell mixer;
+		struct {
+			uint32_t value;
+		} dds;
+		uint64_t data;
+	};
+};
+
+struct hdspe_commands {
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t commands;          /* struct hdspe_command * */
+};
+
+#define SNDRV_HDSPE_IOCTL_SCHEDULE \
+	_IOW('H', 0x51, struct hdspe_commands)
+#define SNDRV_HDSPE_IOCTL_CANCEL_SCHEDULE _IO('H', 0x52)
+
 /* typedefs for compatibility to user-space */
 typedef struct hdspe_peak_rms hdspe_peak_rms_t;
 typedef struct hdspe_config_info hdspe_config_info_t;
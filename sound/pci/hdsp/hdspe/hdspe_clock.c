@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/**
+ * hdspe_clock.c
+ * @brief RME HDSPe driver sample clock estimation.
+ *
+ * A second order delay locked loop, fed with the frame counter and the
+ * CLOCK_MONOTONIC_RAW time stamp of each audio period interrupt, tracks
+ * the time of the period boundaries and the duration of a frame, i.o.w.
+ * the actual sample rate relative to the system clock. See
+ * F. Adriaensen, "Using a DLL to filter time", LAC 2005.
+ *
+ * All arithmetic is fixed point: frame durations are in ns * 2^32, loop
+ * coefficients are fractions * 2^32.
+ *
+ * The estimate also drives a POSIX dynamic clock device per card,
+ * similar to PTP hardware clocks, running at the card sample clock.
+ */
+
+#include "hdspe.h"
+#include "hdspe_core.h"
+
+#include <linux/math64.h>
+#include <linux/posix-clock.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+
+/* Loop bandwidth, in mHz: trade off between jitter rejection and the
+ * time needed to lock, which is a few times 1/bandwidth. */
+#define HDSPE_DLL_BANDWIDTH      500
+
+/* Restart the loop if the time stamp is off by more than this from the
+ * prediction (sample rate change, clock source change ...), or if
+ * more than this number of frames elapsed since the previous update. */
+#define HDSPE_DLL_MAX_ERROR      (5 * NSEC_PER_MSEC)
+#define HDSPE_DLL_MAX_FRAMES     65536
+
+/* Time after (re)starting the loop before we consider it locked. */
+#define HDSPE_DLL_LOCK_TIME      (5 * NSEC_PER_SEC)
+
+/* Card sample clock time at CLOCK_MONOTONIC_RAW time raw: the frames
+ * since the clock was last anchored, extrapolated from the last period
+ * boundary at the estimated frame duration, converted to ns at the
+ * nominal sample rate, and added to the card time at the anchor. The
+ * clock stands still while the loop is stopped. */
+static s64 hdspe_card_time(const struct hdspe_dll *dll, s64 raw)
+{
+	s64 delta = raw - dll->time;
+	u64 scale, card_delta;
+	s64 base;
+
+	if (dll->updates == 0 || dll->rate == 0)
+		return dll->base_time;
+
+	base = dll->base_time + mul_u64_u32_div(dll->pos - dll->base_pos,
+						NSEC_PER_SEC, dll->rate);
+
+	/* ns of card time per ns of raw time, times 2^32 * 10^9 / 10^9 */
+	scale = (u64)dll->rate * dll->frame_ns;
+	card_delta = mul_u64_u64_div_u64(abs(delta), (u64)NSEC_PER_SEC << 32,
+					 scale);
+
+	return delta >= 0 ? base + card_delta : base - card_delta;
+}
+
+static void hdspe_dll_start(struct hdspe *hdspe, u64 pos, s64 time)
+{
+	struct hdspe_dll *dll = &hdspe->dll;
+	u32 rate = hdspe_read_system_sample_rate(hdspe);
+
+	/* Re-anchor the card clock where the previous estimate has it now,
+	 * so it stays continuous and monotonic across sample rate changes
+	 * and restarts. */
+	dll->base_time = hdspe_card_time(dll, time);
+	dll->base_pos = pos;
+
+	dll->pos = pos;
+	dll->time = time;
+	dll->frame_ns = rate > 0 ? div_u64((u64)NSEC_PER_SEC << 32, rate) : 0;
+	dll->error = 0;
+	dll->jitter = 0;
+	dll->start_time = time;
+	dll->rate = HDSPE_FREQ_SAMPLE_RATE(hdspe_sample_rate_freq(rate));
+	dll->updates = rate > 0 ? 1 : 0;
+}
+
+void hdspe_dll_update(struct hdspe *hdspe)
+{
+	struct hdspe_dll *dll = &hdspe->dll;
+	u64 pos = hdspe->frame_count;
+	s64 time = ktime_to_ns(hdspe->irq_time_raw);
+	u64 frames = pos - dll->pos;
+	u64 omega, b, c;
+	s64 period, error;
+
+	if (pos == dll->pos && dll->updates > 0)
+		return;
+
+	if (dll->updates == 0 || pos < dll->pos ||
+	    frames > HDSPE_DLL_MAX_FRAMES) {
+		hdspe_dll_start(hdspe, pos, time);
+		return;
+	}
+
+	period = mul_u64_u64_shr(frames, dll->frame_ns, 32);
+	error = time - (dll->time + period);
+	if (abs(error) > HDSPE_DLL_MAX_ERROR) {
+		dev_dbg(hdspe->card->dev,
+			"%s: phase error %lld ns, restarting.\n",
+			__func__, error);
+		hdspe_dll_start(hdspe, pos, time);
+		return;
+	}
+
+	/* omega = 2 pi bandwidth period, b = sqrt(2) omega, c = omega^2.
+	 * 26986075 = 2 pi 2^32 / 10^12 * 10^9. */
+	omega = min_t(u64, mul_u64_u32_div(period * HDSPE_DLL_BANDWIDTH,
+					   26986075, NSEC_PER_SEC),
+		      1ULL << 31);
+	b = (omega * 92682) >> 16;
+	c = (omega * omega) >> 32;
+
+	dll->time += period + ((error * (s64)b) >> 32);
+	dll->frame_ns += div_s64(error * (s64)c, frames);
+	dll->pos = pos;
+	dll->error = error;
+	dll->jitter += (abs(error) - dll->jitter) / 16;
+	dll->updates++;
+}
+
+static struct hdspe_dll hdspe_dll_snapshot(struct hdspe *hdspe)
+{
+	struct hdspe_dll dll;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&hdspe->irq_seq);
+		dll = hdspe->dll;
+	} while (read_seqcount_retry(&hdspe->irq_seq, seq));
+
+	return dll;
+}
+
+void hdspe_get_clock_estimate(struct hdspe *hdspe,
+			      struct hdspe_clock_estimate *est)
+{
+	struct hdspe_dll dll = hdspe_dll_snapshot(hdspe);
+
+	memset(est, 0, sizeof(*est));
+	est->frame_pos = dll.pos;
+	est->frame_time = dll.time;
+	est->frame_ns_q32 = dll.frame_ns;
+	est->rate_uhz = dll.frame_ns > 0 ?
+		mul_u64_u64_div_u64(1000000ULL * NSEC_PER_SEC, 1ULL << 32,
+				    dll.frame_ns) : 0;
+	est->phase_error = dll.error;
+	est->jitter = dll.jitter;
+	est->locked = dll.updates > 0 &&
+		dll.time - dll.start_time >= HDSPE_DLL_LOCK_TIME;
+	est->updates = dll.updates;
+}
+
+void hdspe_get_clock_crosststamp(struct hdspe *hdspe,
+				 struct hdspe_clock_crosststamp *ts)
+{
+	struct hdspe_dll dll = hdspe_dll_snapshot(hdspe);
+	unsigned long flags;
+	ktime_t raw, mono, real;
+
+	local_irq_save(flags);
+	raw = ktime_get_raw();
+	mono = ktime_get();
+	real = ktime_get_real();
+	local_irq_restore(flags);
+
+	memset(ts, 0, sizeof(*ts));
+	ts->card = hdspe_card_time(&dll, ktime_to_ns(raw));
+	ts->monotonic_raw = ktime_to_ns(raw);
+	ts->monotonic = ktime_to_ns(mono);
+	ts->realtime = ktime_to_ns(real);
+	ts->rate = dll.rate;
+	ts->locked = dll.updates > 0 &&
+		dll.time - dll.start_time >= HDSPE_DLL_LOCK_TIME;
+}
+
+/* ------------------ POSIX dynamic clock -------------------- */
+
+struct hdspe_posix_clock {
+	struct posix_clock clock;
+	struct device dev;
+	struct hdspe *hdspe;
+};
+
+static struct hdspe *hdspe_posix_clock_hdspe(struct posix_clock *pc)
+{
+	return container_of(pc, struct hdspe_posix_clock, clock)->hdspe;
+}
+
+static int hdspe_posix_clock_getres(struct posix_clock *pc,
+				    struct timespec64 *tp)
+{
+	struct hdspe_dll dll = hdspe_dll_snapshot(hdspe_posix_clock_hdspe(pc));
+	*tp = ns_to_timespec64(dll.rate > 0 ? NSEC_PER_SEC / dll.rate : 1);
+	return 0;
+}
+
+static int hdspe_posix_clock_gettime(struct posix_clock *pc,
+				     struct timespec64 *tp)
+{
+	struct hdspe_dll dll = hdspe_dll_snapshot(hdspe_posix_clock_hdspe(pc));
+	*tp = ns_to_timespec64(hdspe_card_time(&dll,
+					       ktime_to_ns(ktime_get_raw())));
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static long hdspe_posix_clock_ioctl(struct posix_clock_context *pccontext,
+				    unsigned int cmd, unsigned long arg)
+{
+	struct posix_clock *pc = pccontext->clk;
+#else
+static long hdspe_posix_clock_ioctl(struct posix_clock *pc,
+				    unsigned int cmd, unsigned long arg)
+{
+#endif
+	struct hdspe_clock_crosststamp ts;
+
+	if (cmd != SNDRV_HDSPE_IOCTL_GET_CLOCK_CROSSTSTAMP)
+		return -ENOTTY;
+
+	hdspe_get_clock_crosststamp(hdspe_posix_clock_hdspe(pc), &ts);
+	if (copy_to_user((void __user *)arg, &ts, sizeof(ts)))
+		return -EFAULT;
+	return 0;
+}
+
+/* The clock cannot be set or adjusted: clock_settime() and
+ * clock_adjtime() fail with EOPNOTSUPP. */
+static const struct posix_clock_operations hdspe_posix_clock_ops = {
+	.owner = THIS_MODULE,
+	.clock_getres = hdspe_posix_clock_getres,
+	.clock_gettime = hdspe_posix_clock_gettime,
+	.ioctl = hdspe_posix_clock_ioctl,
+};
+
+/* The clock device can outlive the card while user space keeps it open.
+ * The POSIX clock core does not call our operations anymore after
+ * posix_clock_unregister(). */
+static void hdspe_posix_clock_release(struct device *dev)
+{
+	struct hdspe_posix_clock *c =
+		container_of(dev, struct hdspe_posix_clock, dev);
+	unregister_chrdev_region(c->dev.devt, 1);
+	kfree(c);
+}
+
+int hdspe_register_posix_clock(struct hdspe *hdspe)
+{
+	struct hdspe_posix_clock *c;
+	dev_t devt;
+	int err;
+
+	err = alloc_chrdev_region(&devt, 0, 1, "hdspe-clock");
+	if (err < 0)
+		return err;
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c) {
+		unregister_chrdev_region(devt, 1);
+		return -ENOMEM;
+	}
+
+	c->hdspe = hdspe;
+	c->clock.ops = hdspe_posix_clock_ops;
+	device_initialize(&c->dev);
+	c->dev.devt = devt;
+	c->dev.parent = &hdspe->pci->dev;
+	c->dev.release = hdspe_posix_clock_release;
+	dev_set_name(&c->dev, "hdspe-clock%d", hdspe->card->number);
+
+	err = posix_clock_register(&c->clock, &c->dev);
+	if (err < 0) {
+		put_device(&c->dev);
+		return err;
+	}
+
+	hdspe->posix_clock = c;
+	dev_dbg(hdspe->card->dev, "%s: registered %s.\n", __func__,
+		dev_name(&c->dev));
+
+	return 0;
+}
+
+void hdspe_unregister_posix_clock(struct hdspe *hdspe)
+{
+	if (!hdspe->posix_clock)
+		return;
+
+	posix_clock_unregister(&hdspe->posix_clock->clock);
+	hdspe->posix_clock = NULL;
+}
@@ -280,7 +280,7 @@ void hdspe_dds_range(struct hdspe* hdspe, u32* min, u32* max)
 
 u32 hdspe_get_dds(struct hdspe* hdspe)
 {
-	return le32_to_cpu(hdspe->reg.pll_freq);
+	return le32_to_cpu(READ_ONCE(hdspe->reg.pll_freq));
 }
 
 int hdspe_write_dds(struct hdspe* hdspe, u32 dds)
@@ -295,14 +295,15 @@ int hdspe_write_dds(struct hdspe* hdspe, u32 dds)
 		goto done;
 	}
 
-	if (dds_le == hdspe->reg.pll_freq) {
-		rc = 0;
-		goto done;
+	/* Also called by the interrupt thread for scheduled commands,
+	 * without control_mutex. */
+	spin_lock(&hdspe->pll_lock);
+	if (dds_le != hdspe->reg.pll_freq) {
+		WRITE_ONCE(hdspe->reg.pll_freq, dds_le);
+		hdspe_write_pll_freq(hdspe);
+		rc = 1;
 	}
-	
-	hdspe->reg.pll_freq = dds_le;
-	hdspe_write_pll_freq(hdspe);
-	rc = 1;
+	spin_unlock(&hdspe->pll_lock);
 
 done:
 	dev_dbg(hdspe->card->dev, "%s() dds = %u sample_rate = %u rc = %d.\n",
@@ -330,6 +331,16 @@ u32 hdspe_read_system_sample_rate(struct hdspe* hdspe)
 	return hdspe_dds_sample_rate(hdspe, hdspe_read_pll_freq(hdspe));
 }
 
+/* Status fields that do not need any register access. */
+static void hdspe_read_stream_status(struct hdspe* hdspe,
+				     struct hdspe_status* status)
+{
+	status->buffer_size = hdspe_period_size(hdspe);
+	status->running = hdspe->running;
+	status->capture_pid = hdspe->capture_pid;
+	status->playback_pid = hdspe->playback_pid;
+}
+
 void hdspe_read_sample_rate_status(struct hdspe* hdspe,
 				   struct hdspe_status* status)
 {
@@ -339,10 +350,67 @@ void hdspe_read_sample_rate_status(struct hdspe* hdspe,
 	status->sample_rate_denominator = hdspe_read_pll_freq(hdspe);
 	status->internal_sample_rate_denominator =
 		le32_to_cpu(hdspe->reg.pll_freq);
-	status->buffer_size = hdspe_period_size(hdspe);
-	status->running = hdspe->running;
-	status->capture_pid = hdspe->capture_pid;
-	status->playback_pid = hdspe->playback_pid;
+	hdspe_read_stream_status(hdspe, status);
+}
+
+/* Read the status from the hardware and publish it as the new status
+ * snapshot. Must hold status_mutex. */
+static void hdspe_publish_status(struct hdspe* hdspe)
+{
+	struct hdspe_status n;
+
+	/* Register writes from now on make the snapshot stale again. */
+	WRITE_ONCE(hdspe->status_stale, false);
+	hdspe->m.read_status(hdspe, &n);
+
+	write_seqlock(&hdspe->status_seqlock);
+	hdspe->status = n;
+	hdspe->status_jiffies = jiffies;
+	write_sequnlock(&hdspe->status_seqlock);
+}
+
+static bool hdspe_status_expired(struct hdspe* hdspe, unsigned long t)
+{
+	return READ_ONCE(hdspe->status_stale) ||
+		time_after(jiffies, t + HZ / HDSPE_STATUS_CHECK_RATE);
+}
+
+void hdspe_get_status(struct hdspe* hdspe, struct hdspe_status* s)
+{
+	unsigned long t;
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&hdspe->status_seqlock);
+		*s = hdspe->status;
+		t = hdspe->status_jiffies;
+	} while (read_seqretry(&hdspe->status_seqlock, seq));
+
+	if (!hdspe_status_expired(hdspe, t)) {
+		hdspe_read_stream_status(hdspe, s);
+		return;
+	}
+
+	mutex_lock(&hdspe->status_mutex);
+	if (hdspe_status_expired(hdspe, hdspe->status_jiffies))
+		hdspe_publish_status(hdspe);
+	*s = hdspe->status;
+	mutex_unlock(&hdspe->status_mutex);
+}
+
+void hdspe_refresh_status(struct hdspe* hdspe, struct hdspe_status* s)
+{
+	mutex_lock(&hdspe->status_mutex);
+	hdspe_publish_status(hdspe);
+	*s = hdspe->status;
+	mutex_unlock(&hdspe->status_mutex);
+}
+
+void hdspe_init_status(struct hdspe* hdspe)
+{
+	seqlock_init(&hdspe->status_seqlock);
+	mutex_init(&hdspe->status_mutex);
+	hdspe->status_stale = true;
 }
 
 static int hdspe_write_system_sample_rate(struct hdspe* hdspe, u32 rate)
@@ -368,6 +436,9 @@ static int hdspe_write_system_sample_rate(struct hdspe* hdspe, u32 rate)
 
 void hdspe_set_channel_map(struct hdspe* hdspe, enum hdspe_speed speed)
 {
+	const signed char *old_map_in = hdspe->channel_map_in;
+	const signed char *old_map_out = hdspe->channel_map_out;
+
 	dev_dbg(hdspe->card->dev, "%s()\n", __func__);
 	
 	switch (speed) {
@@ -401,6 +472,11 @@ void hdspe_set_channel_map(struct hdspe* hdspe, enum hdspe_speed speed)
 	default: {}
 	};
 
+	/* Same speed mode, same channel map: nothing to remap. */
+	if (hdspe->channel_map_in == old_map_in &&
+	    hdspe->channel_map_out == old_map_out)
+		return;
+
 	hdspe_mixer_update_channel_map(hdspe);
 }
 
@@ -93,9 +93,9 @@ int hdspe_control_get(struct snd_kcontrol *kcontrol,
 	int val;
 	struct hdspe *hdspe = snd_kcontrol_chip(kcontrol);
 	dev_dbg(hdspe->card->dev, "hdspe_control_get(%s) ...\n", propname);
-	if (lock_req) spin_lock_irq(&hdspe->lock);
+	if (lock_req) mutex_lock(&hdspe->control_mutex);
 	val = get(hdspe);
-	if (lock_req) spin_unlock_irq(&hdspe->lock);
+	if (lock_req) mutex_unlock(&hdspe->control_mutex);
 	dev_dbg(hdspe->card->dev, "... = %d.\n", val);
 	return val;
 }
@@ -115,12 +115,12 @@ int hdspe_control_put(struct snd_kcontrol *kcontrol, int val,
 	}
 	dev_dbg(hdspe->card->dev, "snd_hdspe_put(%s,%d) %s get() ...\n",
 		propname, val, get ? "with" : "without");
-	if (lock_req) spin_lock_irq(&hdspe->lock);
+	if (lock_req) mutex_lock(&hdspe->control_mutex);
 	oldval = get ? get(hdspe) : val;
 	changed = (val != oldval);
 	if (!get || changed)
 		rc = put(hdspe, val);
-	if (lock_req) spin_unlock_irq(&hdspe->lock);
+	if (lock_req) mutex_unlock(&hdspe->control_mutex);
 	dev_dbg(hdspe->card->dev,
 		"... val = %d, oldval = %d, changed = %d, put rc = %d.\n",
 		val, oldval, changed, rc);
@@ -131,15 +131,39 @@ int hdspe_control_put(struct snd_kcontrol *kcontrol, int val,
 
 HDSPE_RW_INT1_HDSPE_METHODS(status_polling, 0, HZ, 1)
 
+static void hdspe_post_sync_event(struct hdspe *hdspe,
+				  const struct hdspe_status *s, int source)
+{
+	struct hdspe_event ev = { .type = HDSPE_EVENT_SYNC };
+	ev.sync.source = source;
+	ev.sync.status = s->sync[source];
+	ev.sync.freq = s->freq[source];
+	hdspe_post_event(hdspe, &ev);
+}
+
+static void hdspe_post_sample_rate_event(struct hdspe *hdspe,
+					 const struct hdspe_status *s)
+{
+	struct hdspe_event ev = { .type = HDSPE_EVENT_SAMPLE_RATE };
+	ev.sample_rate.numerator = s->sample_rate_numerator;
+	ev.sample_rate.denominator = s->sample_rate_denominator;
+	hdspe_post_event(hdspe, &ev);
+}
+
 void hdspe_status_work(struct work_struct *work)
 {
 	struct hdspe *hdspe = container_of(work, struct hdspe, status_work);
 	int64_t sr_delta;
 	int i;
-	bool changed = false;
 	struct hdspe_status o = hdspe->last_status;
 	struct hdspe_status n;
-	hdspe->m.read_status(hdspe, &n);
+	hdspe_refresh_status(hdspe, &n);
+	hdspe_status_page_status(hdspe, &n);
+
+	for (i = 0; i < HDSPE_CLOCK_SOURCE_COUNT; i++) {
+		if (n.sync[i] != o.sync[i] || n.freq[i] != o.freq[i])
+			hdspe_post_sync_event(hdspe, &n, i);
+	}
 
 	for (i = 0; i < HDSPE_CLOCK_SOURCE_COUNT; i++) {
 		if (n.sync[i] != o.sync[i]) {
@@ -147,7 +171,6 @@ void hdspe_status_work(struct work_struct *work)
 				"sync source %d status changed %d -> %d.\n",
 				i, o.sync[i], n.sync[i]);
 			HDSPE_CTL_NOTIFY(autosync_status);
-			changed = true;
 			break;
 		}
 	}
@@ -158,7 +181,6 @@ void hdspe_status_work(struct work_struct *work)
 				"sync source %d freq changed %d -> %d.\n",
 				i, o.freq[i], n.freq[i]);
 			HDSPE_CTL_NOTIFY(autosync_freq);
-			changed = true;
 			break;
 		}
 	}
@@ -167,7 +189,6 @@ void hdspe_status_work(struct work_struct *work)
 		dev_dbg(hdspe->card->dev, "autosync ref changed %d -> %d.\n",
 			o.autosync_ref, n.autosync_ref);
 		HDSPE_CTL_NOTIFY(autosync_ref);
-		changed = true;
 	}
 
 	sr_delta = (int64_t)n.sample_rate_denominator
@@ -180,38 +201,114 @@ void hdspe_status_work(struct work_struct *work)
 			o.sample_rate_numerator, o.sample_rate_denominator,
 			n.sample_rate_numerator, n.sample_rate_denominator);
 		HDSPE_CTL_NOTIFY(raw_sample_rate);
-		changed = true;
+		hdspe_post_sample_rate_event(hdspe, &n);
 	}
 
-	if (hdspe->m.check_status_change &&
-	    hdspe->m.check_status_change(hdspe, &o, &n))
-		changed = true;
+	if (hdspe->m.check_status_change)
+		hdspe->m.check_status_change(hdspe, &o, &n);
 
-	if (hdspe->tco && hdspe_tco_notify_status_change(hdspe)) {
-		changed = true;
-	}
+	if (hdspe->tco)
+		hdspe_tco_notify_status_change(hdspe);
 	
 	hdspe->last_status = n;
+}
 
-	if (hdspe->last_status_change_jiffies == 0)
-		hdspe->last_status_change_jiffies = jiffies;
-
+void hdspe_check_status(struct hdspe *hdspe)
+{
+	struct hdspe_status_regs *o = &hdspe->status_regs;
+	struct hdspe_status_regs n;
+	union hdspe_status0_reg ignore = { .raw = 0 };
+	u32 pll_delta;
+	bool changed;
+
+	/* Interrupt, buffer pointer and MIDI bits change all the time. */
+	ignore.common.IRQ = 1;
+	ignore.common.BUF_PTR = 0x3ff;
+	ignore.common.BUF_ID = 1;
+	ignore.raw |= hdspe->midiIRQPendingMask;
+
+	memset(&n, 0, sizeof(n));
+	n.status0 = le32_to_cpu(hdspe->reg.status0.raw & ~ignore.raw);
+	if (hdspe->io_type == HDSPE_RAYDAT || hdspe->io_type == HDSPE_AIO ||
+	    hdspe->io_type == HDSPE_AIO_PRO)
+		n.status1 = le32_to_cpu(hdspe_read_status1(hdspe).raw);
+	n.status2 = le32_to_cpu(hdspe_read_status2(hdspe).raw);
+	if (hdspe->io_type != HDSPE_MADI)
+		n.fbits = hdspe_read_fbits(hdspe);
+	n.pll_freq = hdspe_read_pll_freq(hdspe);
+	if (hdspe->tco)
+		n.tco = hdspe_tco_status_bits(hdspe);
+
+	/* The DDS register drifts with the external clock: ignore changes
+	 * below 1 ppm, like hdspe_status_work() does. */
+	pll_delta = n.pll_freq > o->pll_freq ?
+		n.pll_freq - o->pll_freq : o->pll_freq - n.pll_freq;
+	changed = pll_delta > n.pll_freq / 1000000;
+	if (!changed)
+		n.pll_freq = o->pll_freq;
+
+	changed = changed ||
+		n.status0 != o->status0 || n.status1 != o->status1 ||
+		n.status2 != o->status2 || n.fbits != o->fbits ||
+		n.tco != o->tco;
 	if (changed) {
-		hdspe->last_status_change_jiffies = 0;
-		hdspe->status_polling = 0; /* disable - user must re-enable */
-		HDSPE_CTL_NOTIFY(status_polling);
-	} else if (jiffies > hdspe->last_status_change_jiffies + 2*HZ) {
-		dev_dbg(hdspe->card->dev,
-			"%s: polling timeout expired: jiffies=%lu, last_status_change_jiffied=%lu, delta=%ld, 2*HZ=%d.\n", __func__,
-			jiffies, hdspe->last_status_change_jiffies,
-			jiffies - hdspe->last_status_change_jiffies, 2*HZ);
-		hdspe->last_status_change_jiffies = 0;
-		hdspe->status_polling = 0; /* disable - user must re-enable */
-		HDSPE_CTL_NOTIFY(status_polling);
+		*o = n;
+		schedule_work(&hdspe->status_work);
 	}
 }
 
 
+/* -------------- level meters ------------------- */
+
+HDSPE_RW_INT1_HDSPE_METHODS(meter_interval, 0, 1000, 1)
+
+/* -------------- PCM pointer mode ------------------ */
+
+static int snd_hdspe_info_pointer_mode(struct snd_kcontrol *kcontrol,
+				       struct snd_ctl_elem_info *uinfo)
+{
+	static const char *const texts[] = {
+		HDSPE_POINTER_MODE_NAME(0),
+		HDSPE_POINTER_MODE_NAME(1),
+		HDSPE_POINTER_MODE_NAME(2)
+	};
+	ENUMERATED_CTL_INFO(uinfo, texts);
+	return 0;
+}
+
+HDSPE_GETTER(pointer_mode)
+HDSPE_PUTTER(pointer_mode)
+HDSPE_RW_ENUM_METHODS(pointer_mode,
+		      hdspe_get_pointer_mode, hdspe_put_pointer_mode, false)
+
+
+/* ------------------ sample clock estimate -------------------- */
+
+static int snd_hdspe_info_clock_estimate(struct snd_kcontrol* kcontrol,
+					 struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER64;
+	uinfo->count = 5;
+	return 0;
+}
+
+/* Filtered sample rate in micro-Hz, frame position of the last period
+ * boundary and its filtered CLOCK_MONOTONIC_RAW time in ns, average
+ * absolute phase error in ns, and whether or not the loop is locked. */
+static int snd_hdspe_get_clock_estimate(struct snd_kcontrol *kcontrol,
+					struct snd_ctl_elem_value *ucontrol)
+{
+	struct hdspe *hdspe = snd_kcontrol_chip(kcontrol);
+	struct hdspe_clock_estimate est;
+	hdspe_get_clock_estimate(hdspe, &est);
+	ucontrol->value.integer64.value[0] = est.rate_uhz;
+	ucontrol->value.integer64.value[1] = est.frame_pos;
+	ucontrol->value.integer64.value[2] = est.frame_time;
+	ucontrol->value.integer64.value[3] = est.jitter;
+	ucontrol->value.integer64.value[4] = est.locked;
+	return 0;
+}
+
 /* ------------------ raw sample rate and DDS -------------------- */
 
 static int snd_hdspe_info_raw_sample_rate(struct snd_kcontrol* kcontrol,
@@ -227,7 +324,7 @@ static int snd_hdspe_get_raw_sample_rate(struct snd_kcontrol *kcontrol,
 {
 	struct hdspe *hdspe = snd_kcontrol_chip(kcontrol);
 	struct hdspe_status s;
-	hdspe_read_sample_rate_status(hdspe, &s);
+	hdspe_get_status(hdspe, &s);
 	ucontrol->value.integer64.value[0] = s.sample_rate_numerator;
 	ucontrol->value.integer64.value[1] = s.sample_rate_denominator;
 	return 0;
@@ -350,7 +447,7 @@ static int snd_hdspe_get_autosync_status(struct snd_kcontrol *kcontrol,
 	int i;
 
 	struct hdspe_status s;
-	hdspe->m.read_status(hdspe, &s);
+	hdspe_get_status(hdspe, &s);
 	for (i=0; i<hdspe->t.autosync_count-1; i++) {
 		int ref = hdspe->t.autosync_idx2ref[i];
 		ucontrol->value.enumerated.item[i] = s.sync[ref];
@@ -396,7 +493,7 @@ static int snd_hdspe_get_autosync_freq(struct snd_kcontrol *kcontrol,
 	int i;
 
 	struct hdspe_status s;
-	hdspe->m.read_status(hdspe, &s);
+	hdspe_get_status(hdspe, &s);
 	for (i=0; i<hdspe->t.autosync_count-1; i++) {
 		int ref = hdspe->t.autosync_idx2ref[i];
 		ucontrol->value.enumerated.item[i] = s.freq[ref];
@@ -474,7 +571,9 @@ static int snd_hdspe_info_external_freq(struct snd_kcontrol *kcontrol,
 
 static enum hdspe_freq hdspe_get_external_freq(struct hdspe* hdspe)
 {
-	return hdspe_madi_get_external_freq(hdspe);
+	struct hdspe_status s;
+	hdspe_get_status(hdspe, &s);
+	return s.external_freq;
 }
 
 HDSPE_RO_ENUM_METHODS(external_freq, hdspe_get_external_freq);
@@ -747,6 +846,30 @@ HDSPE_RO_INT1_HDSPE_METHODS(playback_pid, 0, 0, 1)
 
 HDSPE_RO_INT1_METHODS(buffer_size, 32, 8192, 1, hdspe_period_size)
 
+static int snd_hdspe_info_xruns(struct snd_kcontrol *kcontrol,
+				struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 4;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = INT_MAX;
+	return 0;
+}
+
+/* Missed playback and capture periods, late playback and capture
+ * interrupts. */
+static int snd_hdspe_get_xruns(struct snd_kcontrol *kcontrol,
+			       struct snd_ctl_elem_value *ucontrol)
+{
+	struct hdspe *hdspe = snd_kcontrol_chip(kcontrol);
+	struct hdspe_xruns *x = &hdspe->xruns;
+	ucontrol->value.integer.value[0] = READ_ONCE(x->missed[0]);
+	ucontrol->value.integer.value[1] = READ_ONCE(x->missed[1]);
+	ucontrol->value.integer.value[2] = READ_ONCE(x->late[0]);
+	ucontrol->value.integer.value[3] = READ_ONCE(x->late[1]);
+	return 0;
+}
+
 static int hdspe_is_tco_present(struct hdspe* hdspe)
 {
 	return hdspe->tco != NULL;
@@ -811,9 +934,13 @@ int snd_hdspe_create_controls(struct snd_card *card,
 
 	HDSPE_ADD_RV_CONTROL_ID(CARD, "Running", running);
 	HDSPE_ADD_RV_CONTROL_ID(CARD, "Buffer Size", buffer_size);
+	HDSPE_ADD_RV_CONTROL_ID(CARD, "Hardware Xruns", xruns);
 
-	HDSPE_ADD_RWV_CONTROL_ID(CARD, "Status Polling", status_polling);
+	HDSPE_ADD_RW_CONTROL_ID(CARD, "Status Polling", status_polling);
+	HDSPE_ADD_RW_CONTROL_ID(CARD, "PCM Pointer Mode", pointer_mode);
 	HDSPE_ADD_RV_CONTROL_ID(HWDEP, "Raw Sample Rate", raw_sample_rate);
+	HDSPE_ADD_RV_CONTROL_ID(HWDEP, "Sample Clock Estimate", clock_estimate);
+	HDSPE_ADD_RW_CONTROL_ID(HWDEP, "Meter Update Interval", meter_interval);
 	HDSPE_ADD_RW_CONTROL_ID(HWDEP, "DDS", dds);
 	HDSPE_ADD_RW_CONTROL_ID(CARD, "Internal Frequency", internal_freq);
 	
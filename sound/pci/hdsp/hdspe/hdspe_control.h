@@ -154,7 +154,7 @@
  * Get the current value for a property 
  * @kcontrol: control element.
  * @get: getter function - does the real work.
- * @lock_req: protect get() by spinlock, if true.
+ * @lock_req: protect get() by the control mutex, if true.
  * @propname: name of the property, for debugging 
  * Returns what get() returns.
  */
@@ -169,7 +169,7 @@ extern int hdspe_control_get(struct snd_kcontrol *kcontrol,
  * @get: getter function - gets current value, for change detection.
  * If NULL, change detection is left to put().
  * @put: putter function - does the real work of setting the new value.
- * @lock_req: protect get() and put() by spinlock, if true.
+ * @lock_req: protect get() and put() by the control mutex, if true.
  * @excl_req: return -EBUSY if we have no exclusive access, if true.
  * @propname: name of the property, for debugging 
  * Returns the return code of put() if nonzero. If put() returns zero,
@@ -270,7 +270,7 @@ static int hdspe_put_##prop(struct hdspe* hdspe, int val)		\
  * @regname: control, settings, or status0: a field of hdspe->reg.
  * @model: madi, aes or raio: a field in hdspe->reg.regname.
  * @field: a bitfield in hdspe->reg.regname.model.
- * @lock_req: if nonzero, protect reading by spin_lock_irq(&hdspe->lock).
+ * @lock_req: if nonzero, protect reading by hdspe->control_mutex.
  * @do_read: if true, read the register from hardware (for status0 register).
  * The generated snd_hdspe_get_<prop> method simply gets the indicated
  * bitfield from the register. 
@@ -305,7 +305,7 @@ static int snd_hdspe_get_##prop(struct snd_kcontrol *kcontrol,	        \
  * hdspe->reg.
  * @model: madi, aes or raio, a field in hdspe->reg.regname.
  * @field: a bitfield in hdspe->reg.regname.card. 
- * @lock_req: if nonzero, protect writing by spin_lock_irq(&hdspe->lock).
+ * @lock_req: if nonzero, protect writing by hdspe->control_mutex.
  * @excl_req: if nonzero, return -EBUSY immediately if we have no
  * exclusive control over the card.
  * The generated snd_hdspe_put_<prop> method sets the indicated
@@ -38,15 +38,28 @@
 #include "hdspe_core.h"
 
 #include <linux/init.h>
+#include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/pci.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <uapi/linux/sched/types.h>
 
 #include <sound/pcm.h>
 #include <sound/initval.h>
 
+#ifndef PCI_IRQ_INTX
+#define PCI_IRQ_INTX PCI_IRQ_LEGACY	/* renamed in kernel 6.8 */
+#endif
+
 static int index[SNDRV_CARDS] = SNDRV_DEFAULT_IDX;	  /* Index 0-MAX */
 static char *id[SNDRV_CARDS] = SNDRV_DEFAULT_STR;	  /* ID for this card */
 static bool enable[SNDRV_CARDS] = SNDRV_DEFAULT_ENABLE_PNP;/* Enable this card */
+static int irq_priority[SNDRV_CARDS];			  /* IRQ thread RT prio */
+static bool msi[SNDRV_CARDS] =				  /* Use MSI */
+	{[0 ... (SNDRV_CARDS-1)] = true};
+static int irq_cpu[SNDRV_CARDS] =			  /* IRQ CPU affinity */
+	{[0 ... (SNDRV_CARDS-1)] = -1};
 
 module_param_array(index, int, NULL, 0444);
 MODULE_PARM_DESC(index, "Index value for RME HDSPE interface.");
@@ -57,6 +70,15 @@ MODULE_PARM_DESC(id, "ID string for RME HDSPE interface.");
 module_param_array(enable, bool, NULL, 0444);
 MODULE_PARM_DESC(enable, "Enable/disable specific HDSPE soundcards.");
 
+module_param_array(irq_priority, int, NULL, 0444);
+MODULE_PARM_DESC(irq_priority, "SCHED_FIFO priority of the interrupt thread (1-99), or 0 for the kernel default.");
+
+module_param_array(msi, bool, NULL, 0444);
+MODULE_PARM_DESC(msi, "Use message signaled interrupts if available (default on).");
+
+module_param_array(irq_cpu, int, NULL, 0444);
+MODULE_PARM_DESC(irq_cpu, "CPU to handle the interrupt on, or -1 for any CPU on the NUMA node of the card (default).");
+
 
 MODULE_AUTHOR
 (
@@ -101,32 +123,26 @@ static const struct pci_device_id snd_hdspe_ids[] = {
 MODULE_DEVICE_TABLE(pci, snd_hdspe_ids);
 
 
-/* interrupt handler */
+/* Hard interrupt handler: only latches the STATUS0 register with a time
+ * stamp, acknowledges the audio interrupt, and disables MIDI input
+ * interrupts until the pending MIDI input has been processed. All else
+ * is done in snd_hdspe_interrupt_thread() for audio interrupts, and in
+ * hdspe_midi_work() for MIDI input. */
 static irqreturn_t snd_hdspe_interrupt(int irq, void *dev_id)
 {
 	struct hdspe *hdspe = (struct hdspe *) dev_id;
-	int i, audio, midi, schedule = 0;
-
-	hdspe->reg.status0 = hdspe_read_status0_nocache(hdspe);
-
-	audio = hdspe->reg.status0.common.IRQ;
-	midi = hdspe->reg.status0.raw & hdspe->midiIRQPendingMask;
-
-#ifdef TIME_INTERRUPT_INTERVAL
-	u64 now = ktime_get_raw_fast_ns();
-	dev_dbg(hdspe->card->dev, "snd_hdspe_interrupt %llu us LAT=%d BUF_ID=%u BUF_PTR=%05u %s%s%s%s%s\n",
-		(now - hdspe->last_interrupt_time) / 1000,
-		hdspe->reg.control.common.LAT,
-		hdspe->reg.status0.common.BUF_ID,
-		le16_to_cpu(hdspe->reg.status0.common.BUF_PTR)<<6,
-		audio ? "AUDIO " : "",
-		hdspe->midiPorts>0 && (hdspe->reg.status0.raw & hdspe->midi[0].irq) ? "MIDI1 " : "",
-		hdspe->midiPorts>1 && (hdspe->reg.status0.raw & hdspe->midi[1].irq) ? "MIDI2 " : "",
-		hdspe->midiPorts>2 && (hdspe->reg.status0.raw & hdspe->midi[2].irq) ? "MIDI3 " : "",
-		hdspe->midiPorts>3 && (hdspe->reg.status0.raw & hdspe->midi[3].irq) ? "MIDI4 " : ""
-		);
-	hdspe->last_interrupt_time = now;
-#endif /*TIME_INTERRUPT_INTERVAL*/
+	union hdspe_status0_reg status0;
+	int i, audio, midi;
+	ktime_t now, now_raw;
+	u64 service;
+
+	/* Time stamp as close as possible to reading the hardware pointer. */
+	now = ktime_get();
+	now_raw = ktime_get_raw();
+	status0 = hdspe_read_status0_nocache(hdspe);
+
+	audio = status0.common.IRQ;
+	midi = status0.raw & hdspe->midiIRQPendingMask;
 
 	if (!audio && !midi)
 		return IRQ_NONE;
@@ -134,50 +150,127 @@ static irqreturn_t snd_hdspe_interrupt(int irq, void *dev_id)
 	if (audio) {
 		hdspe_write(hdspe, HDSPE_interruptConfirmation, 0);
 		hdspe->irq_count++;
-		
-		hdspe_update_frame_count(hdspe);
-
-		if (hdspe->tco) {
-			/* LTC In update must happen before user
-			 * space is notified of a new period */
-			hdspe_tco_period_elapsed(hdspe);
-		}
-
-		if (hdspe->capture_substream)
-			snd_pcm_period_elapsed(hdspe->capture_substream);
-
-		if (hdspe->playback_substream)
-			snd_pcm_period_elapsed(hdspe->playback_substream);
-
-		/* status polling at user controlled rate */
-		if (hdspe->status_polling > 0 &&
-		    jiffies >= hdspe->last_status_jiffies
-		    + HZ/hdspe->status_polling) {
-			hdspe->last_status_jiffies = jiffies;
-			schedule_work(&hdspe->status_work);
-		}
 	}
 
 	if (midi) {
-		schedule = 0;
+		spin_lock(&hdspe->reg_lock);
 		for (i = 0; i < hdspe->midiPorts; i++) {
-			if ((hdspe_read(hdspe,
-					hdspe->midi[i].statusIn) & 0xff) &&
-			    (hdspe->reg.status0.raw & hdspe->midi[i].irq)) {
+			if (status0.raw & hdspe->midi[i].irq) {
 				/* we disable interrupts for this input until
 				 * processing is done */
-				hdspe->reg.control.raw &= ~hdspe->midi[i].ie;
+				hdspe->midi_ie &= ~hdspe->midi[i].ie;
 				hdspe->midi[i].pending = 1;
-				schedule = 1;
 			}
 		}
+		__hdspe_write_control(hdspe);
+		spin_unlock(&hdspe->reg_lock);
+		queue_work(system_highpri_wq, &hdspe->midi_work);
+	}
 
-		if (schedule) {
-			hdspe_write_control(hdspe);
-			queue_work(system_highpri_wq, &hdspe->midi_work);
-		}
+	/* The service time is passed on to the interrupt thread, which
+	 * owns the statistics, like the STATUS0 register. */
+	service = ktime_to_ns(ktime_sub(ktime_get(), now));
+
+	write_seqcount_begin(&hdspe->irq_latch_seq);
+	if (audio) {
+		hdspe->irq_latch_status0 = status0;
+		hdspe->irq_latch_time = now;
+		hdspe->irq_latch_time_raw = now_raw;
 	}
-	
+	hdspe->irq_latch_service = service;
+	hdspe->irq_latch_service_count++;
+	write_seqcount_end(&hdspe->irq_latch_seq);
+
+	return audio ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+/* Set the real-time priority of the interrupt thread, if configured.
+ * Called from the interrupt thread itself. sched_setscheduler_nocheck()
+ * is not exported to modules anymore, sched_setattr_nocheck() is. */
+static void hdspe_set_irq_thread_priority(struct hdspe *hdspe)
+{
+	struct sched_attr attr = {
+		.size = sizeof(attr),
+		.sched_policy = SCHED_FIFO,
+		.sched_priority = hdspe->irq_priority,
+	};
+	int err;
+
+	hdspe->irq_priority_set = true;
+	if (hdspe->irq_priority <= 0)
+		return;
+
+	err = sched_setattr_nocheck(current, &attr);
+	if (err < 0)
+		dev_warn(hdspe->card->dev,
+			 "Could not set interrupt thread priority %d: %d.\n",
+			 hdspe->irq_priority, err);
+	else
+		dev_dbg(hdspe->card->dev,
+			"Interrupt thread priority set to %d.\n",
+			hdspe->irq_priority);
+}
+
+/* Threaded audio interrupt handler: updates the frame counter, TCO state
+ * and PCM substreams. If the thread runs late, only the most recently
+ * latched STATUS0 register is processed. The frame counter logic takes
+ * care of the periods in between. */
+static irqreturn_t snd_hdspe_interrupt_thread(int irq, void *dev_id)
+{
+	struct hdspe *hdspe = (struct hdspe *) dev_id;
+	union hdspe_status0_reg status0;
+	ktime_t time, time_raw;
+	u64 service;
+	u32 service_count;
+	unsigned int seq;
+
+	if (unlikely(!hdspe->irq_priority_set))
+		hdspe_set_irq_thread_priority(hdspe);
+
+	do {
+		seq = read_seqcount_begin(&hdspe->irq_latch_seq);
+		status0 = hdspe->irq_latch_status0;
+		time = hdspe->irq_latch_time;
+		time_raw = hdspe->irq_latch_time_raw;
+		service = hdspe->irq_latch_service;
+		service_count = hdspe->irq_latch_service_count;
+	} while (read_seqcount_retry(&hdspe->irq_latch_seq, seq));
+
+	/* Readers spin while the write section is open: it must not be
+	 * preempted, now that it runs in a thread. */
+	preempt_disable();
+	write_seqcount_begin(&hdspe->irq_seq);
+	hdspe->reg.status0 = status0;
+	hdspe->irq_time = time;
+	hdspe->irq_time_raw = time_raw;
+	hdspe_update_frame_count(hdspe);
+	hdspe_dll_update(hdspe);
+	write_seqcount_end(&hdspe->irq_seq);
+	preempt_enable();
+	hdspe_schedule_period(hdspe);
+	hdspe_irq_stats_interval(hdspe, time, service, service_count);
+
+	if (hdspe->tco) {
+		/* LTC In update must happen before user
+		 * space is notified of a new period */
+		hdspe_tco_period_elapsed(hdspe);
+	}
+
+	hdspe_hist_add(&hdspe->irq_stats.wakeup,
+		       ktime_to_ns(ktime_sub(ktime_get(), time)));
+	hdspe_pcm_period_elapsed(hdspe);
+	hdspe_mixer_ramp_period(hdspe);
+	hdspe_status_page_period(hdspe);
+
+	/* status change detection at bounded rate */
+	if (time_after_eq(jiffies, hdspe->last_status_jiffies
+			  + HZ / (hdspe->status_polling > 0 ?
+				  hdspe->status_polling :
+				  HDSPE_STATUS_CHECK_RATE))) {
+		hdspe->last_status_jiffies = jiffies;
+		hdspe_check_status(hdspe);
+	}
+
 	return IRQ_HANDLED;
 }
 
@@ -185,6 +278,7 @@ static irqreturn_t snd_hdspe_interrupt(int irq, void *dev_id)
  * are enabled when the MIDI devices are created. */
 static void hdspe_start_interrupts(struct hdspe* hdspe)
 {
+	spin_lock_irq(&hdspe->reg_lock);
 	if (hdspe->tco) {
 		/* TCO MTC port is always the last one */
 		struct hdspe_midi *m = &hdspe->midi[hdspe->midiPorts-1];
@@ -192,22 +286,25 @@ static void hdspe_start_interrupts(struct hdspe* hdspe)
 		dev_dbg(hdspe->card->dev,
 			"%s: enabling TCO MTC input port %d '%s'.\n",
 			__func__, m->id, m->portname);
-		hdspe->reg.control.raw |= m->ie;	
+		hdspe->midi_ie |= m->ie;
 	}
 
 	hdspe->reg.control.common.START =
 	hdspe->reg.control.common.IE_AUDIO = true;
 
-	hdspe_write_control(hdspe);
+	__hdspe_write_control(hdspe);
+	spin_unlock_irq(&hdspe->reg_lock);
 }
 
 static void hdspe_stop_interrupts(struct hdspe* hdspe)
 {
 	/* stop the audio, and cancel all interrupts */
+	spin_lock_irq(&hdspe->reg_lock);
 	hdspe->reg.control.common.START =
 	hdspe->reg.control.common.IE_AUDIO = false;
-	hdspe->reg.control.raw &= ~hdspe->midiInterruptEnableMask;
-	hdspe_write_control(hdspe);
+	hdspe->midi_ie &= ~hdspe->midiInterruptEnableMask;
+	__hdspe_write_control(hdspe);
+	spin_unlock_irq(&hdspe->reg_lock);
 }
 
 /* Create ALSA devices, after hardware initialization */
@@ -241,6 +338,15 @@ static int snd_hdspe_create_alsa_devices(struct snd_card *card,
 	dev_dbg(card->dev, "Init proc interface...\n");
 	snd_hdspe_proc_init(hdspe);
 
+	dev_dbg(card->dev, "Init debugfs interface...\n");
+	snd_hdspe_debugfs_init(hdspe);
+
+	dev_dbg(card->dev, "Registering sample clock device...\n");
+	err = hdspe_register_posix_clock(hdspe);
+	if (err < 0)
+		dev_warn(card->dev,
+			 "Sample clock device not available (%d).\n", err);
+
 	dev_dbg(card->dev, "Initializing complete?\n");
 
 	err = snd_card_register(card);
@@ -381,6 +487,86 @@ static enum hdspe_io_type hdspe_get_io_type(int pci_vendor_id, int firmware_rev)
 	return HDSPE_IO_TYPE_INVALID;
 }
 
+/* Route the interrupt to the CPU given by the irq_cpu module parameter,
+ * or else to the CPUs of the NUMA node the card is attached to. DMA
+ * buffers are allocated on that node too, being allocated for the
+ * card's PCI device. */
+static void hdspe_set_irq_affinity(struct hdspe *hdspe)
+{
+	struct device *dev = hdspe->card->dev;
+	int node = dev_to_node(&hdspe->pci->dev);
+	int cpu = irq_cpu[hdspe->dev];
+	const struct cpumask *mask;
+	int err;
+
+	if (cpu >= 0) {
+		if (cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+			dev_warn(dev, "irq_cpu %d is not an online CPU.\n",
+				 cpu);
+			return;
+		}
+		if (node != NUMA_NO_NODE && cpu_to_node(cpu) != node)
+			dev_warn(dev,
+			 "irq_cpu %d is on NUMA node %d, card is on node %d.\n",
+				 cpu, cpu_to_node(cpu), node);
+		mask = cpumask_of(cpu);
+	} else if (node != NUMA_NO_NODE) {
+		mask = cpumask_of_node(node);
+	} else {
+		return;
+	}
+
+	err = irq_set_affinity_hint(hdspe->irq, mask);
+	if (err < 0)
+		dev_warn(dev, "Could not set IRQ %d affinity: %d.\n",
+			 hdspe->irq, err);
+	else
+		dev_dbg(dev, "IRQ %d affinity %*pbl.\n",
+			hdspe->irq, cpumask_pr_args(mask));
+}
+
+/* Use MSI if available and not disabled, or else a legacy, possibly
+ * shared, interrupt. MSI interrupts are never shared, so the handler is
+ * not called for interrupts of other devices. */
+static int hdspe_request_irq(struct hdspe *hdspe)
+{
+	struct snd_card *card = hdspe->card;
+	struct pci_dev *pci = hdspe->pci;
+	unsigned int types = PCI_IRQ_INTX;
+	int err;
+
+	if (msi[hdspe->dev])
+		types |= PCI_IRQ_MSI;
+
+	err = pci_alloc_irq_vectors(pci, 1, 1, types);
+	if (err < 0) {
+		dev_err(card->dev, "unable to allocate IRQ vector: %d\n", err);
+		return err;
+	}
+	hdspe->msi = pci->msi_enabled;
+
+	hdspe->irq_priority = irq_priority[hdspe->dev];
+	if (request_threaded_irq(pci_irq_vector(pci, 0), snd_hdspe_interrupt,
+				 snd_hdspe_interrupt_thread,
+				 hdspe->msi ? 0 : IRQF_SHARED,
+				 KBUILD_MODNAME, hdspe)) {
+		dev_err(card->dev, "unable to use IRQ %d\n",
+			pci_irq_vector(pci, 0));
+		pci_free_irq_vectors(pci);
+		return -EBUSY;
+	}
+
+	hdspe->irq = pci_irq_vector(pci, 0);
+	card->sync_irq = hdspe->irq;
+
+	dev_dbg(card->dev, "use %s IRQ %d\n",
+		hdspe->msi ? "MSI" : "legacy", hdspe->irq);
+
+	hdspe_set_irq_affinity(hdspe);
+
+	return 0;
+}
+
 static int snd_hdspe_create(struct hdspe *hdspe)
 {
 	struct snd_card *card = hdspe->card;
@@ -393,6 +579,13 @@ static int snd_hdspe_create(struct hdspe *hdspe)
 	hdspe->iobase = NULL;
 
 	spin_lock_init(&hdspe->lock);
+	mutex_init(&hdspe->control_mutex);
+	spin_lock_init(&hdspe->reg_lock);
+	spin_lock_init(&hdspe->mixer_lock);
+	spin_lock_init(&hdspe->pll_lock);
+	seqcount_init(&hdspe->irq_seq);
+	seqcount_init(&hdspe->irq_latch_seq);
+	hdspe_init_status(hdspe);
 	INIT_WORK(&hdspe->midi_work, hdspe_midi_work);
 	INIT_WORK(&hdspe->status_work, hdspe_status_work);
 
@@ -454,16 +647,9 @@ static int snd_hdspe_create(struct hdspe *hdspe)
 			(unsigned long)hdspe->iobase, hdspe->port,
 			hdspe->port + io_extent - 1);
 
-	if (request_irq(pci->irq, snd_hdspe_interrupt,
-			IRQF_SHARED, KBUILD_MODNAME, hdspe)) {
-		dev_err(card->dev, "unable to use IRQ %d\n", pci->irq);
-		return -EBUSY;
-	}
-
-	dev_dbg(card->dev, "use IRQ %d\n", pci->irq);
-
-	hdspe->irq = pci->irq;
-	card->sync_irq = hdspe->irq;
+	err = hdspe_request_irq(hdspe);
+	if (err < 0)
+		return err;
 
 	/* Firmware build */
 	hdspe->fw_build = le32_to_cpu(hdspe_read(hdspe, HDSPE_RD_FLASH)) >> 12;
@@ -490,6 +676,21 @@ static int snd_hdspe_create(struct hdspe *hdspe)
 	if (err < 0)
 		return err;
 
+	/* Level meters */
+	err = hdspe_init_meters(hdspe);
+	if (err < 0)
+		return err;
+
+	/* hwdep event queue */
+	err = hdspe_init_events(hdspe);
+	if (err < 0)
+		return err;
+
+	/* timed command queue */
+	err = hdspe_init_schedule(hdspe);
+	if (err < 0)
+		return err;
+
 	/* TCO */
 	err = hdspe_init_tco(hdspe);
 	if (err < 0)
@@ -526,17 +727,34 @@ static int snd_hdspe_create(struct hdspe *hdspe)
 
 static int snd_hdspe_free(struct hdspe * hdspe)
 {
-	if (hdspe->port) {
+	hdspe_unregister_posix_clock(hdspe);
+	snd_hdspe_debugfs_free(hdspe);
+
+	if (hdspe->port)
 		hdspe_stop_interrupts(hdspe);
+
+	/* free_irq() waits for a running interrupt thread to finish. Only
+	 * then work items can be cancelled for good, and the state the
+	 * interrupt thread uses freed. */
+	if (hdspe->irq >= 0) {
+		irq_set_affinity_hint(hdspe->irq, NULL);
+		free_irq(hdspe->irq, (void *) hdspe);
+		pci_free_irq_vectors(hdspe->pci);
+	}
+
+	if (hdspe->port) {
 		cancel_work_sync(&hdspe->midi_work);
 		cancel_work_sync(&hdspe->status_work);
 		hdspe_terminate(hdspe);
 		hdspe_terminate_tco(hdspe);
 		hdspe_terminate_mixer(hdspe);
+		hdspe_terminate_meters(hdspe);
 	}
 
-	if (hdspe->irq >= 0)
-		free_irq(hdspe->irq, (void *) hdspe);
+	vfree(hdspe->status_page);
+	hdspe->status_page = NULL;
+	hdspe_terminate_events(hdspe);
+	hdspe_terminate_schedule(hdspe);
 
 	if (hdspe->iobase)
 		iounmap(hdspe->iobase);
@@ -13,7 +13,6 @@
 /* TODO: undefine in production version */
 #define DEBUG
 #define CONFIG_SND_DEBUG
-//#define TIME_INTERRUPT_INTERVAL
 #define DAW_MODE
 //#define PASSTHROUGH_MODE
 
@@ -22,10 +21,18 @@
 
 #include <linux/io.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/sched/clock.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <sound/core.h>
 #include <sound/control.h>
 #include <sound/info.h>
+#include <sound/memalloc.h>
 
 // #define HDSPE_HDSP_REV  60  //  HDSPe PCIe/ExpressCard
 #define HDSPE_MADI_REV		210  // TODO: use
@@ -803,7 +810,7 @@ struct hdspe_tco {
 	u64 ltc_time;            /* frame_count at start of current period    */
 	u64 ltc_in_frame_count;  /* frame count at start of current LTC       */
 
-	/* for status polling */
+	/* for status change detection */
 	struct hdspe_tco_status last_status;
 
 	/* for measuring the actual LTC In fps and pull factor */
@@ -876,14 +883,159 @@ struct hdspe_tables {
 	const char * const *clock_source_names;
 };
 
+/* Maximum number of channels in a port PCM device. Longer ports, like the
+ * 64 MADI channels, are split in several port PCM devices. */
+#define HDSPE_PORT_MAX_CHANNELS	16
+#define HDSPE_MAX_PORTS		16
+
+/* Port PCM device: the logical channels with a common port name prefix,
+ * e.g. "ADAT1" or "MADI", exposed as a separate PCM device. See
+ * hdspe_pcm.c. Indexed by stream direction (SNDRV_PCM_STREAM_PLAYBACK or
+ * SNDRV_PCM_STREAM_CAPTURE) and speed mode. */
+struct hdspe_port {
+	char prefix[16];                /* port name prefix */
+	int chunk;                      /* HDSPE_PORT_MAX_CHANNELS chunk */
+	unsigned char first[2][HDSPE_SPEED_COUNT]; /* first logical channel */
+	unsigned char count[2][HDSPE_SPEED_COUNT]; /* nr of channels or 0 */
+
+	struct snd_pcm *pcm;
+	struct snd_pcm_substream *substream[2];
+	pid_t pid[2];
+	int running;
+	u64 dma_channels[2];            /* DMA channels claimed */
+	u64 stream_start_pos[2];        /* frame position at stream start */
+	struct snd_dma_buffer buffer[2]; /* persistent DMA buffers */
+};
+
+/* hwdep event queue, see hdspe_events.c. Events are numbered from 0
+ * since the driver was loaded. head is the number of the next event. */
+struct hdspe_events {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	u64 head;
+	struct hdspe_event *ring;   /* HDSPE_EVENT_QUEUE_SIZE events */
+};
+
+/* Timed command queue, see hdspe_schedule.c. The count pending
+ * commands, starting at head in the ring, are kept sorted by frame. */
+struct hdspe_schedule {
+	spinlock_t lock;
+	int head;
+	int count;
+	struct hdspe_command *cmd;  /* ring of HDSPE_SCHEDULE_SIZE commands */
+};
+
+/* Status register bits relevant for status change detection, see
+ * hdspe_check_status(). */
+struct hdspe_status_regs {
+	u32 status0;   /* without interrupt and buffer pointer bits */
+	u32 status1;   /* RayDAT / AIO / AIO Pro only */
+	u32 status2;
+	u32 fbits;     /* all but MADI */
+	u32 pll_freq;  /* DDS sample rate denominator */
+	u64 tco;       /* TCO status bits, if TCO present */
+};
+
+/* Mixer gain ramp in progress, see hdspe_mixer.c. Slots with steps == 0
+ * are free. */
+struct hdspe_mixer_ramp_state {
+	u16 destination;
+	u16 source;                /* as in struct hdspe_mixer_ramp */
+	u16 target;                /* target gain */
+	u16 gain;                  /* gain last written */
+	s32 level;                 /* log2 of gain, 16.16 fixed point */
+	u32 steps;                 /* periods left */
+};
+
+/* Driver resident mixer scene, see hdspe_mixer.c. */
+struct hdspe_mixer_scene_slot {
+	char name[HDSPE_MIXER_SCENE_NAME_LEN];
+	struct hdspe_mixer mixer;
+};
+
+/* Peak and RMS level meter snapshot, see hdspe_meters.c. The staging
+ * buffers mirror the meter register blocks: input, playback and output
+ * channels, in this order. */
+struct hdspe_meters {
+	struct hdspe_meter_page *page;  /* published snapshot, mmap()ed */
+	struct mutex lock;              /* serializes snapshots */
+	struct delayed_work work;       /* refreshes the page while mapped */
+	atomic_t mapped;                /* number of mappings */
+	__le32 peak[3 * HDSPE_MAX_CHANNELS];
+	__le32 rms_l[3 * HDSPE_MAX_CHANNELS];
+	__le32 rms_h[3 * HDSPE_MAX_CHANNELS];
+};
+
+/* Hardware side dropouts, as seen by the interrupt handler, counted per
+ * stream direction (SNDRV_PCM_STREAM_PLAYBACK or CAPTURE) while streams
+ * in that direction are running. */
+struct hdspe_xruns {
+	u32 missed[2];            /* periods without interrupt */
+	u32 late[2];              /* interrupts handled over half a period late */
+	ktime_t missed_time[2];   /* time of most recent missed period */
+	ktime_t late_time[2];     /* time of most recent late interrupt */
+	int running;              /* streams running at previous interrupt */
+};
+
+/* Sample clock delay locked loop state, see hdspe_clock.c. Updated by
+ * the interrupt thread, protected by irq_seq. */
+struct hdspe_dll {
+	u64 pos;                  /* frame position of last period boundary */
+	s64 time;                 /* its filtered time, ns */
+	u64 frame_ns;             /* filtered frame duration, ns * 2^32 */
+	s64 error;                /* last phase error, ns */
+	s64 jitter;               /* average absolute phase error, ns */
+	s64 start_time;           /* time the loop was (re)started, ns */
+	u32 rate;                 /* nominal sample rate at (re)start */
+	u64 updates;              /* updates since (re)start, 0 = stopped */
+	u64 base_pos;             /* frame position at (re)start */
+	s64 base_time;            /* card clock time at base_pos, ns */
+};
+
+/* Log2 histogram: bucket 0 counts zero values, bucket i > 0 counts
+ * values v with 2^(i-1) <= v < 2^i. The last bucket also counts all
+ * larger values. */
+#define HDSPE_HIST_BUCKETS 32
+
+struct hdspe_hist {
+	u32 bucket[HDSPE_HIST_BUCKETS];
+	u64 count;
+	u64 sum;
+	u64 max;
+};
+
+/* Interrupt timing statistics, in nanoseconds. Only the interrupt
+ * thread updates and resets them, so they need no locking. The hard
+ * interrupt handler passes its service time on through irq_latch_seq.
+ * rate and reset are set from process context. The longest section with
+ * local interrupts disabled is the exception: it is updated from
+ * anywhere, without locking, and is only indicative. */
+struct hdspe_irq_stats {
+	struct hdspe_hist jitter;   /* |interval - expected interval| */
+	struct hdspe_hist service;  /* time spent in the interrupt handler */
+	struct hdspe_hist wakeup;   /* interrupt to snd_pcm_period_elapsed() */
+	u64 irqs_off_max;           /* longest interrupts disabled section */
+	const char *irqs_off_where; /* function it was in */
+	ktime_t last_time;          /* previous audio interrupt time */
+	u64 last_frame_count;       /* frame counter at that time */
+	u32 last_service_count;     /* irq_latch_service_count counted */
+	u32 rate;                   /* sample rate, 0 if not known */
+	bool reset;                 /* reset requested */
+};
+
 /* status element ids for status change notification */
 struct hdspe_ctl_ids {
-	// TODO: there's probably a better way to query whether
-	// we're running or changing buffer size, without control elements.
+	// Running state and buffer size changes are also posted on the
+	// hwdep event stream.
 	struct snd_ctl_elem_id* running;
 	struct snd_ctl_elem_id* buffer_size;
 	
 	struct snd_ctl_elem_id* status_polling;
+	struct snd_ctl_elem_id* pointer_mode;
+	struct snd_ctl_elem_id* xruns;
+	struct snd_ctl_elem_id* clock_estimate;
+	struct snd_ctl_elem_id* meter_interval;
+	struct snd_ctl_elem_id* mixer;
 	struct snd_ctl_elem_id* internal_freq;
 	struct snd_ctl_elem_id* raw_sample_rate;
 	struct snd_ctl_elem_id* dds;
@@ -943,35 +1095,46 @@ struct hdspe {
 	struct hdspe_midi midi[HDSPE_MAX_MIDI];
 	struct work_struct midi_work;
 	__le32 midiInterruptEnableMask;
+	__le32 midi_ie;              /* enabled MIDI input interrupts */
 	__le32 midiIRQPendingMask;
 	int midiPorts;               /* number of MIDI ports */
 
-	/* Check for status changes, status_polling times per second, if >0. 
-	 * Status polling is disabled if 0.
-	 * Initially, it is 0 and needs to be enabled by the client.
-	 * hdspe_status_work() resets it to 0 when detecting a change,
-	 * notifying the client with a "Status Polling"
-	 * control notification event and notifications for all
-	 * changed status control elements. 
-	 * Status polling is also automatically disabled by the driver,
-	 * with "Status Polling" notification, after 2 seconds without
-	 * changes. The client must re-enable by setting "Status Polling"
-	 * to a non-zero value to re-enable it. */
+	/* The interrupt thread checks the status registers for changes,
+	 * status_polling times per second, or HDSPE_STATUS_CHECK_RATE
+	 * times per second if 0. Only if any status bits changed, it
+	 * schedules hdspe_status_work(), which reads the full status and
+	 * sends notifications for the changed status control elements. */
 	int status_polling;
 	struct work_struct status_work;
 	unsigned long last_status_jiffies;
-	unsigned long last_status_change_jiffies;
+	struct hdspe_status_regs status_regs;
 	struct hdspe_status last_status;
+
+	/* Status snapshot, see hdspe_get_status() */
+	seqlock_t status_seqlock;
+	struct mutex status_mutex;     /* serializes snapshot refreshes */
+	struct hdspe_status status;
+	unsigned long status_jiffies;  /* time of the snapshot */
+	bool status_stale;             /* registers written since */
 	struct hdspe_ctl_ids cid;   /* control ids to be notified */
 	
 	/* Mixer vars */
 	/* full mixer accessible over mixer ioctl or hwdep-device */
 	struct hdspe_mixer *mixer;
-	struct hdspe_peak_rms peak_rms;
+	struct hdspe_mixer_scene_slot *mixer_scenes[HDSPE_MIXER_SCENES];
+	struct mutex mixer_scene_mutex; /* serializes scene store and recall */
+	struct hdspe_mixer_ramp_state mixer_ramps[HDSPE_MIXER_RAMPS];
+	int mixer_ramps_active;     /* ramps in progress, under mixer_lock */
+	struct hdspe_events events;
+	struct hdspe_schedule schedule;
+	struct hdspe_meters meters;
+	int meter_interval;         /* meter snapshot interval, ms */
 	/* fast alsa mixer */
 	struct snd_kcontrol *playback_mixer_ctls[HDSPE_MAX_CHANNELS];
-	/* but input to much, so not used */
-	struct snd_kcontrol *input_mixer_ctls[HDSPE_MAX_CHANNELS];
+	/* matrix mixer, one control per output row */
+	struct snd_kcontrol *mixer_row_ctls[HDSPE_MIXER_CHANNELS];
+	/* rows changed since last notified */
+	DECLARE_BITMAP(mixer_rows_changed, HDSPE_MIXER_CHANNELS);
 
 	/* Optional Time Code Option module handle (NULL if absent) */
 	struct hdspe_tco *tco;
@@ -987,6 +1150,18 @@ struct hdspe {
 	const char * const *port_names_in;
 	const char * const *port_names_out;
 
+	u64 dma_channels[2];    /* DMA channels claimed by main PCM device */
+
+	/* DMA channel register cache, per stream direction and DMA channel:
+	 * buffer area the page address table points to, and whether the
+	 * channel is enabled. */
+	unsigned char *dma_page_table[2][HDSPE_MAX_CHANNELS];
+	bool dma_enabled[2][HDSPE_MAX_CHANNELS];
+
+	/* Port PCM devices */
+	int port_count;
+	struct hdspe_port ports[HDSPE_MAX_PORTS];
+
 	unsigned char *playback_buffer;	/* suitably aligned address */
 	unsigned char *capture_buffer;	/* suitably aligned address */
 
@@ -994,11 +1169,32 @@ struct hdspe {
 	pid_t playback_pid;	     /* process id which uses capture */
 	int running;		     /* running status */
 
-        spinlock_t lock;
+	/* Locks, outermost first. A lock may only be taken while holding
+	 * locks above it in this list:
+	 *
+	 * control_mutex: read-modify-write of the control, settings and
+	 *               PLL register cache by controls and PCM operations.
+	 *               A mutex, because a speed mode change remaps the
+	 *               mixer, which reschedules. Never taken by the
+	 *               interrupt thread.
+	 * lock:         PCM stream state: substreams, pids, running, DMA
+	 *               channel claims, period size.
+	 * reg_lock:     the control register write itself and midi_ie, which
+	 *               the hard interrupt handler updates. Interrupt safe,
+	 *               held only for a single register write.
+	 *
+	 * mixer_lock, pll_lock, the TCO lock, the status page lock and the
+	 * event queue lock are leaves: nothing else is taken while holding
+	 * them. The mixer and PLL locks do not disable interrupts: the mixer
+	 * and DDS are never touched from the hard interrupt handler.
+	 * pll_lock covers the DDS register write, so the interrupt thread
+	 * can carry out scheduled DDS changes without control_mutex. */
+	struct mutex control_mutex;
+	spinlock_t lock;
+	spinlock_t reg_lock;
+	spinlock_t mixer_lock;
+	spinlock_t pll_lock;
 	int irq_count;		     /* for debug */
-#ifdef TIME_INTERRUPT_INTERVAL
-	u64 last_interrupt_time;
-#endif /*TIME_INTERRUPT_INTERVAL*/
 
 	/* Register cache */
 	struct reg {
@@ -1013,8 +1209,62 @@ struct hdspe {
 	u32 last_hw_pointer;        /* previous period hw pointer */
 	u32 hw_buffer_size;         /* sample buffer size, in nr of samples */
 	u32 period_size;            /* current period size, in nr of samples */
+	enum hdspe_pointer_mode pointer_mode; /* PCM .pointer precision */
+
+	/* Audio interrupt time stamp, paired with the frame counter and
+	 * hardware pointer computed from the STATUS0 register read at
+	 * that time. Protected by irq_seq, written by the interrupt
+	 * thread with preemption disabled. */
+	seqcount_t irq_seq;
+	ktime_t irq_time;           /* CLOCK_MONOTONIC at last audio interrupt */
+	ktime_t irq_time_raw;       /* CLOCK_MONOTONIC_RAW at the same moment */
+	u32 irq_hw_pointer;         /* BUF_PTR, in frames, latched at irq_time */
+	u64 stream_start_pos[2];    /* frame position at stream start */
+
+	/* STATUS0 register and time stamps latched by the hard interrupt
+	 * handler, for the interrupt thread, and the service time of the
+	 * most recent hard interrupt. Protected by irq_latch_seq. */
+	seqcount_t irq_latch_seq;
+	union hdspe_status0_reg irq_latch_status0;
+	ktime_t irq_latch_time;
+	ktime_t irq_latch_time_raw;
+	u64 irq_latch_service;      /* ns */
+	u32 irq_latch_service_count; /* hard interrupts handled */
+	bool msi;                   /* using message signaled interrupt */
+	int irq_priority;           /* interrupt thread RT priority, or 0 */
+	bool irq_priority_set;      /* irq_priority has been applied */
+
+	struct hdspe_dll dll;       /* sample clock estimate, irq_seq */
+	struct hdspe_posix_clock *posix_clock; /* sample clock device */
+
+	/* Read-only status page, mmap()ed on the hwdep device. */
+	struct hdspe_status_page *status_page;
+	spinlock_t status_page_lock;       /* serializes page updates */
+	atomic_t status_page_mapped;       /* number of mappings */
+	unsigned long last_status_page_jiffies;
+	struct hdspe_xruns xruns;
+	struct hdspe_irq_stats irq_stats;
+	struct dentry *debugfs;     /* debugfs directory */
 };
 
+/* Interrupts off time accounting: call hdspe_irqs_off_begin() before
+ * disabling interrupts and hdspe_irqs_off_end() after enabling them
+ * again. */
+static inline u64 hdspe_irqs_off_begin(void)
+{
+	return local_clock();
+}
+
+static inline void hdspe_irqs_off_end(struct hdspe *hdspe, u64 start,
+				      const char *where)
+{
+	u64 t = local_clock() - start;
+
+	if (t > READ_ONCE(hdspe->irq_stats.irqs_off_max)) {
+		WRITE_ONCE(hdspe->irq_stats.irqs_off_max, t);
+		WRITE_ONCE(hdspe->irq_stats.irqs_off_where, where);
+	}
+}
 
 /**
  * Write/read to/from HDSPE with Adresses in Bytes
@@ -1040,22 +1290,43 @@ __le32 hdspe_read(struct hdspe * hdspe, u32 reg)
 #endif
 }
 
+/* The MIDI input interrupt enable bits are kept apart from the control
+ * register cache in midi_ie, so the hard interrupt handler can clear them
+ * without racing with read-modify-write of the cache elsewhere. Caller
+ * holds hdspe->reg_lock. */
+static inline __attribute__((always_inline))
+void __hdspe_write_control(struct hdspe* hdspe)
+{
+	lockdep_assert_held(&hdspe->reg_lock);
+	hdspe_write(hdspe, HDSPE_WR_CONTROL,
+		    hdspe->reg.control.raw | hdspe->midi_ie);
+	WRITE_ONCE(hdspe->status_stale, true);
+}
+
 static inline __attribute__((always_inline))
 void hdspe_write_control(struct hdspe* hdspe)
 {
-	hdspe_write(hdspe, HDSPE_WR_CONTROL, hdspe->reg.control.raw);
+	unsigned long flags;
+	u64 t = hdspe_irqs_off_begin();
+
+	spin_lock_irqsave(&hdspe->reg_lock, flags);
+	__hdspe_write_control(hdspe);
+	spin_unlock_irqrestore(&hdspe->reg_lock, flags);
+	hdspe_irqs_off_end(hdspe, t, __func__);
 }
 
 static inline __attribute__((always_inline))
 void hdspe_write_settings(struct hdspe* hdspe)
 {
 	hdspe_write(hdspe, HDSPE_WR_SETTINGS, hdspe->reg.settings.raw);
+	WRITE_ONCE(hdspe->status_stale, true);
 }
 
 static inline __attribute__((always_inline))
 void hdspe_write_pll_freq(struct hdspe* hdspe)
 {
 	hdspe_write(hdspe, HDSPE_WR_PLL_FREQ, hdspe->reg.pll_freq);
+	WRITE_ONCE(hdspe->status_stale, true);
 }
 
 // status0 register is read at every interrupt if audio is started and
@@ -1136,6 +1407,32 @@ extern snd_pcm_uframes_t hdspe_hw_pointer(struct hdspe *hdspe);
  * than once since the previous invocation. */
 extern void hdspe_update_frame_count(struct hdspe* hdspe);
 
+/* Bit mask of running stream directions, on the main PCM device and
+ * per-port PCM devices together. */
+extern int hdspe_running_streams(struct hdspe *hdspe);
+
+/* Called from the interrupt handler after hdspe_update_frame_count():
+ * signals period elapsed to the open substreams that want period 
+ * wakeups. */
+extern void hdspe_pcm_period_elapsed(struct hdspe* hdspe);
+
+/* Frame position at the time of the last audio interrupt: frame_count
+ * plus the offset of the hardware pointer into the current period. */
+extern u64 hdspe_irq_frame_pos(struct hdspe* hdspe);
+
+/* Hardware pointer for the PCM .pointer callback, according to
+ * hdspe->pointer_mode. Sets runtime->delay such that snd_pcm_delay()
+ * reflects the current position, also if the returned pointer is the
+ * one latched at the last period interrupt. */
+extern snd_pcm_uframes_t hdspe_pcm_pointer(struct hdspe *hdspe,
+				   struct snd_pcm_substream *substream);
+
+#ifdef CONFIG_SND_DEBUG
+/* Proc file reporting interleaved format conversion throughput. */
+extern void hdspe_pcm_proc_copy_benchmark(struct snd_info_entry *entry,
+					  struct snd_info_buffer *buffer);
+#endif /*CONFIG_SND_DEBUG*/
+
 /**
  * hdspe_midi.c
  */
@@ -1157,6 +1454,60 @@ extern int snd_hdspe_create_hwdep(struct snd_card *card,
 
 extern void hdspe_get_card_info(struct hdspe* hdspe, struct hdspe_card_info *s);
 
+/* Update the period interrupt part of the status page. Called from the
+ * interrupt thread. */
+extern void hdspe_status_page_period(struct hdspe *hdspe);
+
+/* Update the status part of the status page. */
+extern void hdspe_status_page_status(struct hdspe *hdspe,
+				     const struct hdspe_status *s);
+
+/**
+ * hdspe_clock.c
+ */
+
+/* Feed the frame counter and raw time stamp of the last audio interrupt
+ * to the sample clock delay locked loop. Called from the interrupt thread
+ * right after hdspe_update_frame_count(), within the irq_seq write
+ * section. */
+extern void hdspe_dll_update(struct hdspe *hdspe);
+
+/* Consistent snapshot of the sample clock estimate. */
+extern void hdspe_get_clock_estimate(struct hdspe *hdspe,
+				     struct hdspe_clock_estimate *est);
+
+/* Cross time stamp of the card sample clock and system clocks. */
+extern void hdspe_get_clock_crosststamp(struct hdspe *hdspe,
+					struct hdspe_clock_crosststamp *ts);
+
+/* Register / unregister the card sample clock as POSIX dynamic clock. */
+extern int hdspe_register_posix_clock(struct hdspe *hdspe);
+
+extern void hdspe_unregister_posix_clock(struct hdspe *hdspe);
+
+/**
+ * hdspe_debugfs.c
+ */
+extern void snd_hdspe_debugfs_init(struct hdspe *hdspe);
+
+extern void snd_hdspe_debugfs_free(struct hdspe *hdspe);
+
+/* Update the interrupt interval jitter and service time histograms, or
+ * reset all interrupt timing statistics if requested. Called from the
+ * interrupt thread for each audio interrupt, after updating the frame
+ * counter, with the latched hard interrupt service time. */
+extern void hdspe_irq_stats_interval(struct hdspe *hdspe, ktime_t now,
+				     u64 service, u32 service_count);
+
+static inline void hdspe_hist_add(struct hdspe_hist *h, u64 val)
+{
+	h->bucket[min_t(int, fls64(val), HDSPE_HIST_BUCKETS - 1)]++;
+	h->count++;
+	h->sum += val;
+	if (val > h->max)
+		h->max = val;
+}
+
 /**
  * hdspe_proc.c
  */
@@ -1213,6 +1564,12 @@ extern int hdspe_add_control_id(struct hdspe* hdspe,
 
 extern void hdspe_status_work(struct work_struct* work);
 
+/* Status change detection rate, if status_polling is 0. */
+#define HDSPE_STATUS_CHECK_RATE 10
+
+/* Check status registers for changes, from the interrupt thread. */
+extern void hdspe_check_status(struct hdspe* hdspe);
+
 #define HDSPE_CTL_NOTIFY(prop)					\
 	snd_ctl_notify(hdspe->card, SNDRV_CTL_EVENT_MASK_VALUE, \
 		       hdspe->cid.prop);
@@ -1224,6 +1581,87 @@ extern int hdspe_init_mixer(struct hdspe* hdspe);
 
 extern void hdspe_terminate_mixer(struct hdspe* hdspe);
 
+/* Apply a SNDRV_HDSPE_IOCTL_SET_MIXER request. Returns the number of
+ * faders changed, or a negative error code. */
+extern int hdspe_set_mixer(struct hdspe* hdspe,
+			   const struct hdspe_mixer_set* req);
+
+/* Mixer scene hwdep ioctls. */
+extern int hdspe_store_mixer_scene(struct hdspe* hdspe,
+				   const struct hdspe_mixer_scene* req);
+
+extern int hdspe_get_mixer_scene(struct hdspe* hdspe,
+				 struct hdspe_mixer_scene* req);
+
+extern int hdspe_recall_mixer_scene(struct hdspe* hdspe,
+				    struct hdspe_mixer_scene_recall* req);
+
+/* Set one fader, source as for the "Mixer" control. Sets changed_pb[dest]
+ * if a simple playback mixer control needs to be notified. Returns 1 if
+ * the fader changed. */
+extern int hdspe_set_mixer_gain(struct hdspe* hdspe, unsigned int dest,
+				unsigned int source, u16 gain,
+				bool* changed_pb);
+
+extern void hdspe_notify_mixer(struct hdspe* hdspe, const bool* changed_pb);
+
+/* Start the gain ramps of a SNDRV_HDSPE_IOCTL_RAMP_MIXER request. */
+extern int hdspe_ramp_mixer(struct hdspe* hdspe,
+			    const struct hdspe_mixer_ramps* req);
+
+/* Advance the mixer gain ramps by one step. Called from the interrupt
+ * thread for each audio interrupt. */
+extern void hdspe_mixer_ramp_period(struct hdspe* hdspe);
+
+/**
+ * hdspe_events.c
+ */
+extern int hdspe_init_events(struct hdspe *hdspe);
+
+extern void hdspe_terminate_events(struct hdspe *hdspe);
+
+/* Post an event to the hwdep event queue. Fills in the frame count and
+ * time. Any context. */
+extern void hdspe_post_event(struct hdspe *hdspe, struct hdspe_event *ev);
+
+extern int hdspe_events_open(struct hdspe *hdspe, struct file *file);
+
+extern long hdspe_events_read(struct hdspe *hdspe, char __user *buf,
+			      long count, loff_t *offset);
+
+extern __poll_t hdspe_events_poll(struct hdspe *hdspe, struct file *file,
+				  poll_table *wait);
+
+/**
+ * hdspe_schedule.c
+ */
+extern int hdspe_init_schedule(struct hdspe *hdspe);
+
+extern void hdspe_terminate_schedule(struct hdspe *hdspe);
+
+extern int hdspe_schedule_commands(struct hdspe *hdspe,
+				   const struct hdspe_commands *req);
+
+extern void hdspe_cancel_schedule(struct hdspe *hdspe);
+
+/* Carry out the commands due in the coming period. Called from the
+ * interrupt thread right after updating the frame counter. */
+extern void hdspe_schedule_period(struct hdspe *hdspe);
+
+/**
+ * hdspe_meters.c
+ */
+extern int hdspe_init_meters(struct hdspe *hdspe);
+
+extern void hdspe_terminate_meters(struct hdspe *hdspe);
+
+/* Peak and RMS levels, from a snapshot at most meter_interval ms old. */
+extern int hdspe_get_peak_rms(struct hdspe *hdspe,
+			      struct hdspe_peak_rms *levels);
+
+extern int hdspe_meters_mmap(struct hdspe *hdspe,
+			     struct vm_area_struct *area);
+
 extern int hdspe_create_mixer_controls(struct hdspe* hdspe);
 
 #ifdef OLDSTUFF
@@ -1257,9 +1695,12 @@ extern void hdspe_tco_mtc(struct hdspe* hdspe,
 /* Scheduled from the audio interrupt handler */
 extern void hdspe_tco_period_elapsed(struct hdspe* hdspe);
 	
-/* TCO module status polling */
+/* TCO module status change detection */
 extern bool hdspe_tco_notify_status_change(struct hdspe* hdspe);
 
+/* TCO status register bits relevant for status change detection. */
+extern u64 hdspe_tco_status_bits(struct hdspe* hdspe);
+
 /* Set "app" sample rate on TCO module, when sound card sample rate changes. */
 extern void hdspe_tco_set_app_sample_rate(struct hdspe* hdspe);
 
@@ -1333,6 +1774,18 @@ extern u32 hdspe_read_system_sample_rate(struct hdspe* hdspe);
 extern void hdspe_read_sample_rate_status(struct hdspe* hdspe,
 					  struct hdspe_status* status);
 
+/* Status snapshot, shared by all status readers. hdspe_get_status()
+ * returns the snapshot, lock-free, and only reads the hardware if the
+ * snapshot is older than 1/HDSPE_STATUS_CHECK_RATE seconds, or if
+ * the control, settings or DDS register was written since.
+ * hdspe_refresh_status() reads the hardware unconditionally and
+ * publishes the result. Process context only. */
+extern void hdspe_init_status(struct hdspe* hdspe);
+
+extern void hdspe_get_status(struct hdspe* hdspe, struct hdspe_status* s);
+
+extern void hdspe_refresh_status(struct hdspe* hdspe, struct hdspe_status* s);
+
 /* Set arbitray sample rate in the cards range, writing the control
  * register single speed frequency closest to the desired rate,
  * the speed mode corresponding with the desired rate, and the pll_freq
@@ -1345,20 +1798,16 @@ extern void hdspe_read_sample_rate_status(struct hdspe* hdspe,
  * 1 : new rate set. */
 extern int hdspe_set_sample_rate(struct hdspe * hdspe, u32 desired_rate);
 
-/* Check if same process is writing and reading. */
+/* Check if same process is writing and reading. Lock free: the answer
+ * is advisory and may be stale as soon as it is returned anyway. */
 static inline __attribute__((always_inline))
 int snd_hdspe_use_is_exclusive(struct hdspe *hdspe)
 {
-	unsigned long flags;
-	int ret = 1;
+	pid_t playback_pid = READ_ONCE(hdspe->playback_pid);
+	pid_t capture_pid = READ_ONCE(hdspe->capture_pid);
 
-	spin_lock_irqsave(&hdspe->lock, flags);
-	if ((hdspe->playback_pid != hdspe->capture_pid) &&
-	    (hdspe->playback_pid >= 0) && (hdspe->capture_pid >= 0)) {
-		ret = 0;
-	}
-	spin_unlock_irqrestore(&hdspe->lock, flags);
-	return ret;
+	return !(playback_pid != capture_pid &&
+		 playback_pid >= 0 && capture_pid >= 0);
 }
 
 /* read_status() helper. */
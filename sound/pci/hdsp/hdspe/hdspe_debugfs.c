@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/**
+ * hdspe_debugfs.c
+ * @brief RME HDSPe driver debugfs interface.
+ *
+ * Interrupt timing statistics, for qualifying systems for operation at
+ * small period sizes, without rebuilding the driver:
+ *
+ * cat /sys/kernel/debug/snd-hdspe-<card number>/irq_stats
+ * echo 1 > /sys/kernel/debug/snd-hdspe-<card number>/irq_stats  (reset)
+ */
+
+#include "hdspe.h"
+#include "hdspe_core.h"
+
+#include <linux/debugfs.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+
+static void hdspe_irq_stats_clear(struct hdspe_irq_stats *s)
+{
+	memset(&s->jitter, 0, sizeof(s->jitter));
+	memset(&s->service, 0, sizeof(s->service));
+	memset(&s->wakeup, 0, sizeof(s->wakeup));
+	WRITE_ONCE(s->irqs_off_max, 0);
+	WRITE_ONCE(s->irqs_off_where, NULL);
+}
+
+/* Service times of hard interrupts in between interrupt thread runs
+ * are not counted: only the most recent one is latched. */
+void hdspe_irq_stats_interval(struct hdspe *hdspe, ktime_t now,
+			      u64 service, u32 service_count)
+{
+	struct hdspe_irq_stats *s = &hdspe->irq_stats;
+	u32 rate = READ_ONCE(s->rate);
+
+	if (READ_ONCE(s->reset)) {
+		hdspe_irq_stats_clear(s);
+		WRITE_ONCE(s->reset, false);
+	} else if (s->last_time != 0 && rate != 0 &&
+		   hdspe->frame_count > s->last_frame_count) {
+		/* The frame counter is period aligned, so this is the
+		 * interval we would have in absence of interrupt latency.
+		 * Missed interrupts show up as multiple periods. */
+		s64 expected = mul_u64_u32_div(
+			hdspe->frame_count - s->last_frame_count,
+			NSEC_PER_SEC, rate);
+		s64 interval = ktime_to_ns(ktime_sub(now, s->last_time));
+		hdspe_hist_add(&s->jitter, abs(interval - expected));
+	}
+
+	if (service_count != s->last_service_count)
+		hdspe_hist_add(&s->service, service);
+
+	s->last_time = now;
+	s->last_frame_count = hdspe->frame_count;
+	s->last_service_count = service_count;
+}
+
+static void hdspe_hist_show(struct seq_file *m, const char *name,
+			    const struct hdspe_hist *h)
+{
+	int i, last;
+
+	seq_printf(m, "%s: count %llu, mean %llu ns, max %llu ns\n",
+		   name, h->count,
+		   h->count > 0 ? div64_u64(h->sum, h->count) : 0,
+		   h->max);
+
+	for (last = HDSPE_HIST_BUCKETS - 1; last > 0; last--)
+		if (h->bucket[last] > 0)
+			break;
+
+	for (i = 0; i <= last; i++) {
+		if (i < HDSPE_HIST_BUCKETS - 1)
+			seq_printf(m, "  < %10llu ns: %u\n",
+				   1ULL << i, h->bucket[i]);
+		else
+			seq_printf(m, "  >=%10llu ns: %u\n",
+				   1ULL << (i - 1), h->bucket[i]);
+	}
+}
+
+static int hdspe_irq_stats_show(struct seq_file *m, void *v)
+{
+	struct hdspe *hdspe = m->private;
+	struct hdspe_irq_stats *s = &hdspe->irq_stats;
+	int i;
+
+	seq_printf(m, "period %u frames, rate %u Hz, %d interrupts\n",
+		   hdspe->period_size, READ_ONCE(s->rate), hdspe->irq_count);
+	hdspe_hist_show(m, "interval jitter", &s->jitter);
+	hdspe_hist_show(m, "service time", &s->service);
+	hdspe_hist_show(m, "period elapsed delay", &s->wakeup);
+	seq_printf(m, "longest interrupts off section: %llu ns (%s)\n",
+		   READ_ONCE(s->irqs_off_max),
+		   READ_ONCE(s->irqs_off_where) ?: "-");
+
+	for (i = 0; i < 2; i++) {
+		struct hdspe_xruns *x = &hdspe->xruns;
+		seq_printf(m, "%s: %u missed periods (last at %lld ns), %u late interrupts (last at %lld ns)\n",
+			   i == SNDRV_PCM_STREAM_PLAYBACK ? "playback" : "capture",
+			   x->missed[i], ktime_to_ns(x->missed_time[i]),
+			   x->late[i], ktime_to_ns(x->late_time[i]));
+	}
+
+	return 0;
+}
+
+static int hdspe_irq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hdspe_irq_stats_show, inode->i_private);
+}
+
+/* Any write resets the statistics. The reset is carried out by the
+ * interrupt handler at the next audio interrupt. */
+static ssize_t hdspe_irq_stats_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct hdspe *hdspe = ((struct seq_file *)file->private_data)->private;
+
+	mutex_lock(&hdspe->control_mutex);
+	WRITE_ONCE(hdspe->irq_stats.rate,
+		   hdspe_read_system_sample_rate(hdspe));
+	mutex_unlock(&hdspe->control_mutex);
+
+	WRITE_ONCE(hdspe->irq_stats.reset, true);
+
+	return count;
+}
+
+static const struct file_operations hdspe_irq_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = hdspe_irq_stats_open,
+	.read = seq_read,
+	.write = hdspe_irq_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void snd_hdspe_debugfs_init(struct hdspe *hdspe)
+{
+	char name[32];
+
+	hdspe->irq_stats.rate = hdspe_read_system_sample_rate(hdspe);
+
+	snprintf(name, sizeof(name), "snd-hdspe-%d", hdspe->card->number);
+	hdspe->debugfs = debugfs_create_dir(name, NULL);
+	debugfs_create_file("irq_stats", 0644, hdspe->debugfs, hdspe,
+			    &hdspe_irq_stats_fops);
+}
+
+void snd_hdspe_debugfs_free(struct hdspe *hdspe)
+{
+	debugfs_remove_recursive(hdspe->debugfs);
+	hdspe->debugfs = NULL;
+}
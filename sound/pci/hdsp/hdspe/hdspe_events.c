@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/**
+ * hdspe_events.c
+ * @brief RME HDSPe driver hwdep event stream.
+ *
+ * Status, sync, LTC, xrun, running state and buffer size changes are
+ * posted to a ring of HDSPE_EVENT_QUEUE_SIZE events, read with read()
+ * and poll() on the hwdep device. The read position of each reader is
+ * the file position, counted in events since the driver was loaded.
+ */
+
+#include "hdspe.h"
+#include "hdspe_core.h"
+
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+/* Number of events copied to user space per ring lock. */
+#define HDSPE_EVENT_BATCH 8
+
+void hdspe_post_event(struct hdspe *hdspe, struct hdspe_event *ev)
+{
+	struct hdspe_events *e = &hdspe->events;
+	unsigned long flags;
+
+	if (!e->ring)
+		return;
+
+	ev->frame_count = hdspe->frame_count;
+	ev->time = ktime_get_ns();
+
+	spin_lock_irqsave(&e->lock, flags);
+	e->ring[e->head % HDSPE_EVENT_QUEUE_SIZE] = *ev;
+	e->head++;
+	spin_unlock_irqrestore(&e->lock, flags);
+
+	wake_up_interruptible(&e->wait);
+}
+
+static u64 hdspe_events_head(struct hdspe_events *e)
+{
+	unsigned long flags;
+	u64 head;
+
+	spin_lock_irqsave(&e->lock, flags);
+	head = e->head;
+	spin_unlock_irqrestore(&e->lock, flags);
+	return head;
+}
+
+int hdspe_events_open(struct hdspe *hdspe, struct file *file)
+{
+	/* Only events posted from now on. */
+	file->f_pos = hdspe_events_head(&hdspe->events);
+	return 0;
+}
+
+/* Like the other ALSA hwdep drivers, read() always blocks until events
+ * are available: the hwdep read operation has no access to the file
+ * flags. Non-blocking readers use poll() first. */
+long hdspe_events_read(struct hdspe *hdspe, char __user *buf, long count,
+		       loff_t *offset)
+{
+	struct hdspe_events *e = &hdspe->events;
+	struct hdspe_event batch[HDSPE_EVENT_BATCH];
+	u64 pos = *offset;
+	long n, max, done = 0;
+	int err;
+
+	if (count < (long)sizeof(struct hdspe_event))
+		return -EINVAL;
+
+	err = wait_event_interruptible(e->wait, hdspe_events_head(e) != pos);
+	if (err)
+		return err;
+
+	while ((max = (count - done) / sizeof(batch[0])) > 0) {
+		max = min_t(long, max, HDSPE_EVENT_BATCH);
+		spin_lock_irq(&e->lock);
+		for (n = 0; n < max && pos != e->head; n++) {
+			if (e->head - pos > HDSPE_EVENT_QUEUE_SIZE) {
+				u64 oldest = e->head - HDSPE_EVENT_QUEUE_SIZE;
+				memset(&batch[n], 0, sizeof(batch[n]));
+				batch[n].type = HDSPE_EVENT_OVERFLOW;
+				batch[n].overflow.lost =
+					min_t(u64, oldest - pos, U32_MAX);
+				pos = oldest;
+			} else {
+				batch[n] = e->ring[pos %
+						   HDSPE_EVENT_QUEUE_SIZE];
+				pos++;
+			}
+		}
+		spin_unlock_irq(&e->lock);
+
+		if (n == 0)
+			break;
+		if (copy_to_user(buf + done, batch, n * sizeof(batch[0])))
+			return done > 0 ? done : -EFAULT;
+		done += n * sizeof(batch[0]);
+		*offset = pos;
+	}
+
+	return done;
+}
+
+__poll_t hdspe_events_poll(struct hdspe *hdspe, struct file *file,
+			   poll_table *wait)
+{
+	struct hdspe_events *e = &hdspe->events;
+
+	poll_wait(file, &e->wait, wait);
+	return hdspe_events_head(e) != (u64)file->f_pos ?
+		EPOLLIN | EPOLLRDNORM : 0;
+}
+
+int hdspe_init_events(struct hdspe *hdspe)
+{
+	struct hdspe_events *e = &hdspe->events;
+
+	spin_lock_init(&e->lock);
+	init_waitqueue_head(&e->wait);
+	e->head = 0;
+	e->ring = kcalloc(HDSPE_EVENT_QUEUE_SIZE, sizeof(*e->ring),
+			  GFP_KERNEL);
+	return e->ring ? 0 : -ENOMEM;
+}
+
+void hdspe_terminate_events(struct hdspe *hdspe)
+{
+	kfree(hdspe->events.ring);
+	hdspe->events.ring = NULL;
+}
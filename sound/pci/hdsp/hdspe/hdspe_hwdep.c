@@ -7,12 +7,19 @@
  * 20210810,12 - PhB : new card info ioctl.
  * 20211125 - PhB : IOCTL_GET_CONFIG reimplemented in terms of hdspe_status.
  *
+ * The hwdep device also offers read-only status and level meter pages
+ * with mmap(), and an event stream with read() and poll().
+ *
  * Refactored work of the other MODULE_AUTHORs.
  */
 
 #include "hdspe.h"
 #include "hdspe_core.h"
 
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
 #include <sound/hwdep.h>
 
 #ifdef OLDSTUFF
@@ -32,6 +39,23 @@ static int snd_hdspe_hwdep_dummy_op(struct snd_hwdep *hw, struct file *file)
 	return 0;
 }
 
+static int snd_hdspe_hwdep_open(struct snd_hwdep *hw, struct file *file)
+{
+	return hdspe_events_open(hw->private_data, file);
+}
+
+static long snd_hdspe_hwdep_read(struct snd_hwdep *hw, char __user *buf,
+				 long count, loff_t *offset)
+{
+	return hdspe_events_read(hw->private_data, buf, count, offset);
+}
+
+static __poll_t snd_hdspe_hwdep_poll(struct snd_hwdep *hw, struct file *file,
+				     poll_table *wait)
+{
+	return hdspe_events_poll(hw->private_data, file, wait);
+}
+
 static inline int copy_u32_le(void __user *dest, void __iomem *src)
 {
 	u32 val = readl(src);
@@ -59,17 +83,25 @@ static int snd_hdspe_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
 	void __user *argp = (void __user *)arg;
 	struct hdspe *hdspe = hw->private_data;
 	struct hdspe_mixer_ioctl mixer;
+	struct hdspe_mixer_set mixer_set;
+	struct hdspe_mixer_scene mixer_scene;
+	struct hdspe_mixer_scene_recall mixer_scene_recall;
+	struct hdspe_mixer_ramps mixer_ramps;
+	struct hdspe_commands commands;
 	struct hdspe_config info;
 	struct hdspe_version hdspe_version;
 	struct hdspe_peak_rms *levels;
 #ifdef OLDSTUFF	
 	struct hdspe_ltc ltc;
+	long unsigned int s;
+	int i = 0;
 #endif /*OLDSTUFF*/
 	struct hdspe_status status;
 	struct hdspe_card_info card_info;
 	struct hdspe_tco_status tco_status;
-	long unsigned int s;
-	int i = 0;
+	struct hdspe_clock_estimate clock_estimate;
+	struct hdspe_clock_crosststamp clock_crosststamp;
+	int err;
 
 	switch (cmd) {
 
@@ -81,11 +113,25 @@ static int snd_hdspe_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
 		break;
 
 	case SNDRV_HDSPE_IOCTL_GET_STATUS:
-		hdspe->m.read_status(hdspe, &status);
+		hdspe_get_status(hdspe, &status);
 		if (copy_to_user(argp, &status, sizeof(struct hdspe_status)))
 			return -EFAULT;
 		break;
 
+	case SNDRV_HDSPE_IOCTL_GET_CLOCK_ESTIMATE:
+		hdspe_get_clock_estimate(hdspe, &clock_estimate);
+		if (copy_to_user(argp, &clock_estimate,
+				 sizeof(struct hdspe_clock_estimate)))
+			return -EFAULT;
+		break;
+
+	case SNDRV_HDSPE_IOCTL_GET_CLOCK_CROSSTSTAMP:
+		hdspe_get_clock_crosststamp(hdspe, &clock_crosststamp);
+		if (copy_to_user(argp, &clock_crosststamp,
+				 sizeof(struct hdspe_clock_crosststamp)))
+			return -EFAULT;
+		break;
+
 	case SNDRV_HDSPE_IOCTL_GET_LTC:
 		if (!hdspe->tco) {
 			dev_dbg(hdspe->card->dev, "%s: %d: EINVAL\n", __func__, __LINE__);
@@ -99,45 +145,15 @@ static int snd_hdspe_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
 		break;
 		
 	case SNDRV_HDSPE_IOCTL_GET_PEAK_RMS:
-		levels = &hdspe->peak_rms;
-		for (i = 0; i < HDSPE_MAX_CHANNELS; i++) {
-			levels->input_peaks[i] =
-				readl(hdspe->iobase +
-						HDSPE_MADI_INPUT_PEAK + i*4);
-			levels->playback_peaks[i] =
-				readl(hdspe->iobase +
-						HDSPE_MADI_PLAYBACK_PEAK + i*4);
-			levels->output_peaks[i] =
-				readl(hdspe->iobase +
-						HDSPE_MADI_OUTPUT_PEAK + i*4);
-
-			levels->input_rms[i] =
-				((uint64_t) readl(hdspe->iobase +
-					HDSPE_MADI_INPUT_RMS_H + i*4) << 32) |
-				(uint64_t) readl(hdspe->iobase +
-						HDSPE_MADI_INPUT_RMS_L + i*4);
-			levels->playback_rms[i] =
-				((uint64_t)readl(hdspe->iobase +
-					HDSPE_MADI_PLAYBACK_RMS_H+i*4) << 32) |
-				(uint64_t)readl(hdspe->iobase +
-					HDSPE_MADI_PLAYBACK_RMS_L + i*4);
-			levels->output_rms[i] =
-				((uint64_t)readl(hdspe->iobase +
-					HDSPE_MADI_OUTPUT_RMS_H + i*4) << 32) |
-				(uint64_t)readl(hdspe->iobase +
-						HDSPE_MADI_OUTPUT_RMS_L + i*4);
-		}
-
-		levels->speed = hdspe_speed_mode(hdspe);
-		levels->status2 = hdspe_read_status2(hdspe).raw;
-
-		s = copy_to_user(argp, levels, sizeof(*levels));
-		if (0 != s) {
-			/* dev_err(hdspe->card->dev, "copy_to_user(.., .., %lu): %lu
-			 [Levels]\n", sizeof(struct hdspe_peak_rms), s);
-			 */
-			return -EFAULT;
-		}
+		levels = kmalloc(sizeof(*levels), GFP_KERNEL);
+		if (!levels)
+			return -ENOMEM;
+		err = hdspe_get_peak_rms(hdspe, levels);
+		if (!err && copy_to_user(argp, levels, sizeof(*levels)))
+			err = -EFAULT;
+		kfree(levels);
+		if (err < 0)
+			return err;
 		break;
 
 #ifdef OLDSTUFF	  
@@ -191,8 +207,7 @@ static int snd_hdspe_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
 	case SNDRV_HDSPE_IOCTL_GET_CONFIG:
 
 		memset(&info, 0, sizeof(info));
-		spin_lock_irq(&hdspe->lock);
-		hdspe->m.read_status(hdspe, &status);
+		hdspe_get_status(hdspe, &status);
 		info.pref_sync_ref = status.preferred_ref;
 		info.wordclock_sync_check =
 			status.sync[HDSPE_CLOCK_SOURCE_WORD];
@@ -221,7 +236,6 @@ static int snd_hdspe_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
 		info.line_out = hdspe->reg.control.common.LineOut;
 		info.passthru = 0;
 #endif /*OLDSTUFF*/
-		spin_unlock_irq(&hdspe->lock);
 		if (copy_to_user(argp, &info, sizeof(info)))
 			return -EFAULT;
 		break;
@@ -251,6 +265,60 @@ static int snd_hdspe_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
 			return -EFAULT;
 		break;
 
+	case SNDRV_HDSPE_IOCTL_SET_MIXER:
+		if (copy_from_user(&mixer_set, argp, sizeof(mixer_set)))
+			return -EFAULT;
+		err = hdspe_set_mixer(hdspe, &mixer_set);
+		if (err < 0)
+			return err;
+		mixer_set.changed = err;
+		if (copy_to_user(argp, &mixer_set, sizeof(mixer_set)))
+			return -EFAULT;
+		break;
+
+	case SNDRV_HDSPE_IOCTL_STORE_MIXER_SCENE:
+		if (copy_from_user(&mixer_scene, argp, sizeof(mixer_scene)))
+			return -EFAULT;
+		return hdspe_store_mixer_scene(hdspe, &mixer_scene);
+
+	case SNDRV_HDSPE_IOCTL_GET_MIXER_SCENE:
+		if (copy_from_user(&mixer_scene, argp, sizeof(mixer_scene)))
+			return -EFAULT;
+		err = hdspe_get_mixer_scene(hdspe, &mixer_scene);
+		if (err < 0)
+			return err;
+		if (copy_to_user(argp, &mixer_scene, sizeof(mixer_scene)))
+			return -EFAULT;
+		break;
+
+	case SNDRV_HDSPE_IOCTL_RECALL_MIXER_SCENE:
+		if (copy_from_user(&mixer_scene_recall, argp,
+				   sizeof(mixer_scene_recall)))
+			return -EFAULT;
+		err = hdspe_recall_mixer_scene(hdspe, &mixer_scene_recall);
+		if (err < 0)
+			return err;
+		if (copy_to_user(argp, &mixer_scene_recall,
+				 sizeof(mixer_scene_recall)))
+			return -EFAULT;
+		break;
+
+	case SNDRV_HDSPE_IOCTL_RAMP_MIXER:
+		if (copy_from_user(&mixer_ramps, argp, sizeof(mixer_ramps)))
+			return -EFAULT;
+		return hdspe_ramp_mixer(hdspe, &mixer_ramps);
+
+	case SNDRV_HDSPE_IOCTL_SCHEDULE:
+		if (copy_from_user(&commands, argp, sizeof(commands)))
+			return -EFAULT;
+		return hdspe_schedule_commands(hdspe, &commands);
+
+	case SNDRV_HDSPE_IOCTL_CANCEL_SCHEDULE:
+		if (!snd_hdspe_use_is_exclusive(hdspe))
+			return -EBUSY;
+		hdspe_cancel_schedule(hdspe);
+		break;
+
 	default:
 		dev_dbg(hdspe->card->dev, "%s: %d: cmd=%u EINVAL\n", __func__, __LINE__, cmd);
 		return -EINVAL;
@@ -258,6 +326,142 @@ static int snd_hdspe_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
 	return 0;
 }
 
+/* ------------------ Status page -------------------- */
+
+/* The status page is updated from the interrupt thread and from the
+ * status worker, serialized by status_page_lock. User space readers
+ * synchronize with the seq field, like a seqcount. */
+static void hdspe_status_page_begin(struct hdspe *hdspe)
+{
+	struct hdspe_status_page *p = hdspe->status_page;
+	WRITE_ONCE(p->seq, p->seq + 1);
+	smp_wmb();
+}
+
+static void hdspe_status_page_end(struct hdspe *hdspe)
+{
+	struct hdspe_status_page *p = hdspe->status_page;
+	smp_wmb();
+	WRITE_ONCE(p->seq, p->seq + 1);
+}
+
+void hdspe_status_page_period(struct hdspe *hdspe)
+{
+	struct hdspe_status_page *p = hdspe->status_page;
+	unsigned long flags;
+
+	if (!p)
+		return;
+
+	spin_lock_irqsave(&hdspe->status_page_lock, flags);
+	hdspe_status_page_begin(hdspe);
+	p->frame_count = hdspe->frame_count;
+	p->irq_time = ktime_to_ns(hdspe->irq_time);
+	p->irq_time_raw = ktime_to_ns(hdspe->irq_time_raw);
+	p->buf_ptr = hdspe->irq_hw_pointer;
+	p->running = hdspe_running_streams(hdspe);
+	if (hdspe->tco) {
+		p->ltc_in = hdspe->tco->ltc_in;
+		p->ltc_in_frame_count = hdspe->tco->ltc_in_frame_count;
+	}
+	hdspe_status_page_end(hdspe);
+	spin_unlock_irqrestore(&hdspe->status_page_lock, flags);
+
+	/* Refresh the status part now and then while mapped. */
+	if (atomic_read(&hdspe->status_page_mapped) > 0 &&
+	    time_after_eq(jiffies, hdspe->last_status_page_jiffies
+			  + HZ / HDSPE_STATUS_PAGE_RATE)) {
+		hdspe->last_status_page_jiffies = jiffies;
+		schedule_work(&hdspe->status_work);
+	}
+}
+
+void hdspe_status_page_status(struct hdspe *hdspe,
+			      const struct hdspe_status *s)
+{
+	struct hdspe_status_page *p = hdspe->status_page;
+	unsigned long flags;
+	int i;
+
+	if (!p)
+		return;
+
+	spin_lock_irqsave(&hdspe->status_page_lock, flags);
+	hdspe_status_page_begin(hdspe);
+	p->status_time = ktime_get_ns();
+	p->sample_rate_numerator = s->sample_rate_numerator;
+	p->sample_rate_denominator = s->sample_rate_denominator;
+	p->internal_sample_rate_denominator =
+		s->internal_sample_rate_denominator;
+	p->clock_mode = s->clock_mode;
+	p->internal_freq = s->internal_freq;
+	p->preferred_ref = s->preferred_ref;
+	p->autosync_ref = s->autosync_ref;
+	p->external_freq = s->external_freq;
+	p->speed_mode = s->speed_mode;
+	for (i = 0; i < HDSPE_CLOCK_SOURCE_COUNT; i++) {
+		p->sync[i] = s->sync[i];
+		p->freq[i] = s->freq[i];
+	}
+	hdspe_status_page_end(hdspe);
+	spin_unlock_irqrestore(&hdspe->status_page_lock, flags);
+}
+
+/* Called when a mapping is duplicated on fork() or split, but not for
+ * the initial mmap(): snd_hdspe_hwdep_mmap() counts that one. */
+static void snd_hdspe_hwdep_vm_open(struct vm_area_struct *area)
+{
+	struct hdspe *hdspe = area->vm_private_data;
+	atomic_inc(&hdspe->status_page_mapped);
+}
+
+static void snd_hdspe_hwdep_vm_close(struct vm_area_struct *area)
+{
+	struct hdspe *hdspe = area->vm_private_data;
+	atomic_dec(&hdspe->status_page_mapped);
+}
+
+static const struct vm_operations_struct snd_hdspe_hwdep_vm_ops = {
+	.open = snd_hdspe_hwdep_vm_open,
+	.close = snd_hdspe_hwdep_vm_close,
+};
+
+static int snd_hdspe_hwdep_mmap(struct snd_hwdep *hw, struct file *file,
+				struct vm_area_struct *area)
+{
+	struct hdspe *hdspe = hw->private_data;
+	struct hdspe_status status;
+	int err;
+
+	if (area->vm_pgoff == HDSPE_MMAP_OFFSET_METERS >> PAGE_SHIFT)
+		return hdspe_meters_mmap(hdspe, area);
+
+	if (area->vm_pgoff != HDSPE_MMAP_OFFSET_STATUS >> PAGE_SHIFT ||
+	    area->vm_end - area->vm_start > PAGE_SIZE)
+		return -EINVAL;
+	if (area->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	err = remap_vmalloc_range(area, hdspe->status_page, 0);
+	if (err < 0)
+		return err;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(area, VM_MAYWRITE);
+#else
+	area->vm_flags &= ~VM_MAYWRITE;
+#endif
+	area->vm_ops = &snd_hdspe_hwdep_vm_ops;
+	area->vm_private_data = hdspe;
+	atomic_inc(&hdspe->status_page_mapped);
+
+	/* Don't make the first reader wait for the status worker. */
+	hdspe_get_status(hdspe, &status);
+	hdspe_status_page_status(hdspe, &status);
+
+	return 0;
+}
+
 int snd_hdspe_create_hwdep(struct snd_card *card,
 			   struct hdspe *hdspe)
 {
@@ -268,14 +472,24 @@ int snd_hdspe_create_hwdep(struct snd_card *card,
 	if (err < 0)
 		return err;
 
+	hdspe->status_page = vmalloc_user(PAGE_SIZE);
+	if (!hdspe->status_page)
+		return -ENOMEM;
+	hdspe->status_page->version = HDSPE_VERSION;
+	spin_lock_init(&hdspe->status_page_lock);
+	atomic_set(&hdspe->status_page_mapped, 0);
+
 	hdspe->hwdep = hw;
 	hw->private_data = hdspe;
 	strcpy(hw->name, "HDSPE hwdep interface");
 
-	hw->ops.open = snd_hdspe_hwdep_dummy_op;
+	hw->ops.open = snd_hdspe_hwdep_open;
 	hw->ops.ioctl = snd_hdspe_hwdep_ioctl;
 	hw->ops.ioctl_compat = snd_hdspe_hwdep_ioctl;
 	hw->ops.release = snd_hdspe_hwdep_dummy_op;
+	hw->ops.mmap = snd_hdspe_hwdep_mmap;
+	hw->ops.read = snd_hdspe_hwdep_read;
+	hw->ops.poll = snd_hdspe_hwdep_poll;
 
 	return 0;
 }
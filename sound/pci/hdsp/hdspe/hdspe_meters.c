@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/**
+ * hdspe_meters.c
+ * @brief RME HDSPe driver peak and RMS level meters.
+ *
+ * The level meter registers are read in bulk at most once every
+ * meter_interval ms, and the result is served to all clients from a
+ * single snapshot, with the SNDRV_HDSPE_IOCTL_GET_PEAK_RMS ioctl or
+ * through a read-only page mmap()ed on the hwdep device.
+ */
+
+#include "hdspe.h"
+#include "hdspe_core.h"
+
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+
+/* Default meter snapshot interval, in ms. */
+#define HDSPE_METER_INTERVAL     20
+
+/* Read all meter registers in three bursts into the staging buffers,
+ * then publish them on the meter page. Must hold meters->lock. */
+static void hdspe_meters_snapshot(struct hdspe *hdspe)
+{
+	struct hdspe_meters *m = &hdspe->meters;
+	struct hdspe_meter_page *p = m->page;
+	const int n = HDSPE_MAX_CHANNELS;
+	int i;
+
+	memcpy_fromio(m->peak, hdspe->iobase + HDSPE_MADI_INPUT_PEAK,
+		      sizeof(m->peak));
+	memcpy_fromio(m->rms_h, hdspe->iobase + HDSPE_MADI_INPUT_RMS_H,
+		      sizeof(m->rms_h));
+	memcpy_fromio(m->rms_l, hdspe->iobase + HDSPE_MADI_INPUT_RMS_L,
+		      sizeof(m->rms_l));
+
+	WRITE_ONCE(p->seq, p->seq + 1);
+	smp_wmb();
+
+	for (i = 0; i < n; i++) {
+		p->levels.input_peaks[i] = le32_to_cpu(m->peak[i]);
+		p->levels.playback_peaks[i] = le32_to_cpu(m->peak[n + i]);
+		p->levels.output_peaks[i] = le32_to_cpu(m->peak[2*n + i]);
+		p->levels.input_rms[i] =
+			((u64)le32_to_cpu(m->rms_h[i]) << 32) |
+			le32_to_cpu(m->rms_l[i]);
+		p->levels.playback_rms[i] =
+			((u64)le32_to_cpu(m->rms_h[n + i]) << 32) |
+			le32_to_cpu(m->rms_l[n + i]);
+		p->levels.output_rms[i] =
+			((u64)le32_to_cpu(m->rms_h[2*n + i]) << 32) |
+			le32_to_cpu(m->rms_l[2*n + i]);
+	}
+	p->levels.speed = hdspe_speed_mode(hdspe);
+	p->levels.status2 = hdspe_read_status2(hdspe).raw;
+	p->time = ktime_get_ns();
+	p->interval_ms = hdspe->meter_interval;
+
+	smp_wmb();
+	WRITE_ONCE(p->seq, p->seq + 1);
+}
+
+static bool hdspe_meters_stale(struct hdspe *hdspe)
+{
+	s64 age = ktime_get_ns() - hdspe->meters.page->time;
+	return age >= (s64)hdspe->meter_interval * NSEC_PER_MSEC;
+}
+
+int hdspe_get_peak_rms(struct hdspe *hdspe, struct hdspe_peak_rms *levels)
+{
+	struct hdspe_meters *m = &hdspe->meters;
+
+	if (mutex_lock_interruptible(&m->lock))
+		return -ERESTARTSYS;
+	if (hdspe_meters_stale(hdspe))
+		hdspe_meters_snapshot(hdspe);
+	*levels = m->page->levels;
+	mutex_unlock(&m->lock);
+
+	return 0;
+}
+
+/* Keeps the meter page up to date while it is mapped. */
+static void hdspe_meters_work(struct work_struct *work)
+{
+	struct hdspe_meters *m =
+		container_of(work, struct hdspe_meters, work.work);
+	struct hdspe *hdspe = container_of(m, struct hdspe, meters);
+
+	mutex_lock(&m->lock);
+	if (hdspe_meters_stale(hdspe))
+		hdspe_meters_snapshot(hdspe);
+	mutex_unlock(&m->lock);
+
+	if (atomic_read(&m->mapped) > 0)
+		schedule_delayed_work(&m->work,
+			max(msecs_to_jiffies(hdspe->meter_interval), 1UL));
+}
+
+/* Duplicated (fork) or split mappings. The initial mmap() is counted
+ * by hdspe_meters_mmap(). */
+static void hdspe_meters_vm_open(struct vm_area_struct *area)
+{
+	struct hdspe *hdspe = area->vm_private_data;
+	atomic_inc(&hdspe->meters.mapped);
+}
+
+static void hdspe_meters_vm_close(struct vm_area_struct *area)
+{
+	struct hdspe *hdspe = area->vm_private_data;
+	atomic_dec(&hdspe->meters.mapped);
+}
+
+static const struct vm_operations_struct hdspe_meters_vm_ops = {
+	.open = hdspe_meters_vm_open,
+	.close = hdspe_meters_vm_close,
+};
+
+int hdspe_meters_mmap(struct hdspe *hdspe, struct vm_area_struct *area)
+{
+	struct hdspe_meters *m = &hdspe->meters;
+	int err;
+
+	if (area->vm_end - area->vm_start > PAGE_ALIGN(sizeof(*m->page)))
+		return -EINVAL;
+	if (area->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	err = remap_vmalloc_range(area, m->page, 0);
+	if (err < 0)
+		return err;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(area, VM_MAYWRITE);
+#else
+	area->vm_flags &= ~VM_MAYWRITE;
+#endif
+	area->vm_ops = &hdspe_meters_vm_ops;
+	area->vm_private_data = hdspe;
+	if (atomic_inc_return(&m->mapped) == 1)
+		schedule_delayed_work(&m->work, 0);
+
+	return 0;
+}
+
+int hdspe_init_meters(struct hdspe *hdspe)
+{
+	struct hdspe_meters *m = &hdspe->meters;
+
+	m->page = vmalloc_user(PAGE_ALIGN(sizeof(*m->page)));
+	if (!m->page)
+		return -ENOMEM;
+	m->page->version = HDSPE_VERSION;
+
+	mutex_init(&m->lock);
+	INIT_DELAYED_WORK(&m->work, hdspe_meters_work);
+	atomic_set(&m->mapped, 0);
+	hdspe->meter_interval = HDSPE_METER_INTERVAL;
+
+	return 0;
+}
+
+void hdspe_terminate_meters(struct hdspe *hdspe)
+{
+	struct hdspe_meters *m = &hdspe->meters;
+
+	if (!m->page)
+		return;
+
+	cancel_delayed_work_sync(&m->work);
+	vfree(m->page);
+	m->page = NULL;
+}
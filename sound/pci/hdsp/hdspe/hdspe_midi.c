@@ -119,10 +119,10 @@ static int snd_hdspe_midi_input_read (struct hdspe_midi *hmidi)
 	spin_unlock_irqrestore(&hmidi->lock, flags);
 
 	/* re-enable MIDI interrupt (was disabled in snd_hdspe_interrupt()) */
-	spin_lock_irqsave(&hmidi->hdspe->lock, flags);
-	hmidi->hdspe->reg.control.raw |= hmidi->ie;
-	hdspe_write_control(hmidi->hdspe);
-	spin_unlock_irqrestore(&hmidi->hdspe->lock, flags);
+	spin_lock_irqsave(&hmidi->hdspe->reg_lock, flags);
+	hmidi->hdspe->midi_ie |= hmidi->ie;
+	__hdspe_write_control(hmidi->hdspe);
+	spin_unlock_irqrestore(&hmidi->hdspe->reg_lock, flags);
 
 	return snd_hdspe_midi_output_write (hmidi);
 }
@@ -139,22 +139,26 @@ snd_hdspe_midi_input_trigger(struct snd_rawmidi_substream *substream, int up)
 		return;
 	}
 
-	spin_lock_irqsave (&hdspe->lock, flags);
+	/* Flush outside the register lock: reg_lock is held for single
+	 * register writes only. */
+	if (up && !(READ_ONCE(hdspe->midi_ie) & hmidi->ie))
+		snd_hdspe_flush_midi_input (hdspe, hmidi->id);
+
+	spin_lock_irqsave (&hdspe->reg_lock, flags);
 	if (up) {
-		if (!(hdspe->reg.control.raw & hmidi->ie)) {
-			snd_hdspe_flush_midi_input (hdspe, hmidi->id);
-			hdspe->reg.control.raw |= hmidi->ie;
-			hdspe_write_control(hdspe);
+		if (!(hdspe->midi_ie & hmidi->ie)) {
+			hdspe->midi_ie |= hmidi->ie;
+			__hdspe_write_control(hdspe);
 			changed = true;
 		}
 	} else {
-		if ((hdspe->reg.control.raw & hmidi->ie) != 0) {
-			hdspe->reg.control.raw &= ~hmidi->ie;
-			hdspe_write_control(hdspe);
+		if ((hdspe->midi_ie & hmidi->ie) != 0) {
+			hdspe->midi_ie &= ~hmidi->ie;
+			__hdspe_write_control(hdspe);
 			changed = true;
 		}
 	}
-	spin_unlock_irqrestore (&hdspe->lock, flags);
+	spin_unlock_irqrestore (&hdspe->reg_lock, flags);
 	return;
 
 	if (changed)
@@ -14,7 +14,12 @@
 #include "hdspe_core.h"
 #include "hdspe_control.h"
 
+#include <sound/tlv.h>
+
+#include <linux/mm.h>
 #include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
 
 
 /* for each output channel (chan) I have an Input (in) and Playback (pb) Fader
@@ -38,17 +43,24 @@ static inline u16 hdspe_read_pb_gain(struct hdspe * hdspe, unsigned int chan,
 	return hdspe->mixer->ch[chan].pb[pb];
 }
 
+/* Gain writes go through the cache: hardware is only written if the
+ * cached value changes. Return 1 if written, 0 if not. */
 static int hdspe_write_in_gain(struct hdspe *hdspe, unsigned int chan,
 				      unsigned int in, u16 data)
 {
 	if (chan >= HDSPE_MIXER_CHANNELS || in >= HDSPE_MIXER_CHANNELS)
 		return -1;
 
+	if (hdspe->mixer->ch[chan].in[in] == data)
+		return 0;
+
+	hdspe->mixer->ch[chan].in[in] = data;
+	set_bit(chan, hdspe->mixer_rows_changed);
 	hdspe_write(hdspe,
 		    HDSPE_MADI_mixerBase +
 		    ((in + 128 * chan) * sizeof(u32)),
-		    cpu_to_le32(hdspe->mixer->ch[chan].in[in] = data & 0xFFFF));
-	return 0;
+		    cpu_to_le32(data));
+	return 1;
 }
 
 static int hdspe_write_pb_gain(struct hdspe *hdspe, unsigned int chan,
@@ -57,11 +69,53 @@ static int hdspe_write_pb_gain(struct hdspe *hdspe, unsigned int chan,
 	if (chan >= HDSPE_MIXER_CHANNELS || pb >= HDSPE_MIXER_CHANNELS)
 		return -1;
 
+	if (hdspe->mixer->ch[chan].pb[pb] == data)
+		return 0;
+
+	hdspe->mixer->ch[chan].pb[pb] = data;
+	set_bit(chan, hdspe->mixer_rows_changed);
 	hdspe_write(hdspe,
 		    HDSPE_MADI_mixerBase +
 		    ((64 + pb + 128 * chan) * sizeof(u32)),
-		    (hdspe->mixer->ch[chan].pb[pb] = data & 0xFFFF));
-	return 0;
+		    data);
+	return 1;
+}
+
+/* Write one fader in the cache and hardware. Returns 1 if changed. */
+static int hdspe_write_gain(struct hdspe* hdspe, unsigned int dest,
+			    unsigned int source, u16 gain, bool* changed_pb)
+{
+	if (source < HDSPE_MIXER_CHANNELS)
+		return hdspe_write_in_gain(hdspe, dest, source, gain);
+
+	source -= HDSPE_MIXER_CHANNELS;
+	if (!hdspe_write_pb_gain(hdspe, dest, source, gain))
+		return 0;
+	if (dest == source)
+		changed_pb[dest] = true;
+	return 1;
+}
+
+/* Write the whole mixer cache to hardware, e.g. when the hardware
+ * state is unknown. Process context only: that is 8192 register writes,
+ * so we reschedule after each row. */
+static void hdspe_write_mixer(struct hdspe *hdspe)
+{
+	int i, j;
+
+	for (i = 0; i < HDSPE_MIXER_CHANNELS; i++) {
+		for (j = 0; j < HDSPE_MIXER_CHANNELS; j++) {
+			hdspe_write(hdspe,
+				    HDSPE_MADI_mixerBase +
+				    ((j + 128 * i) * sizeof(u32)),
+				    cpu_to_le32(hdspe->mixer->ch[i].in[j]));
+			hdspe_write(hdspe,
+				    HDSPE_MADI_mixerBase +
+				    ((64 + j + 128 * i) * sizeof(u32)),
+				    hdspe->mixer->ch[i].pb[j]);
+		}
+		cond_resched();
+	}
 }
 
 void hdspe_mixer_read_proc(struct snd_info_entry *entry,
@@ -99,13 +153,30 @@ void hdspe_mixer_read_proc(struct snd_info_entry *entry,
 	}
 }
 
+/* Notify the matrix mixer row controls of rows changed since the
+ * previous notification. */
+static void hdspe_notify_mixer_rows(struct hdspe* hdspe)
+{
+	int i;
+
+	for (i = 0; i < HDSPE_MIXER_CHANNELS; i++) {
+		if (test_and_clear_bit(i, hdspe->mixer_rows_changed) &&
+		    hdspe->mixer_row_ctls[i])
+			snd_ctl_notify(hdspe->card, SNDRV_CTL_EVENT_MASK_VALUE,
+				       &hdspe->mixer_row_ctls[i]->id);
+	}
+}
+
 void hdspe_mixer_update_channel_map(struct hdspe* hdspe)
 {
 	int i, j;
 	bool used[HDSPE_MAX_CHANNELS];
 
 	dev_dbg(hdspe->card->dev, "%s:\n", __func__);
-	
+
+	/* The mixer lock is taken per row, in order to bound the time
+	 * it is held. */
+
 	/* mute all unused playback channels */
 	for (i = 0; i < HDSPE_MIXER_CHANNELS; i ++) {
 		used[i] = false;
@@ -115,6 +186,7 @@ void hdspe_mixer_update_channel_map(struct hdspe* hdspe)
 		used[c] = true;
 	}
 	for (i = 0; i < HDSPE_MIXER_CHANNELS; i ++) {
+		spin_lock(&hdspe->mixer_lock);
 		if (!used[i]) {
 			for (j = 0; j < HDSPE_MIXER_CHANNELS; j ++) {
 				hdspe_write_in_gain(hdspe, i, j, 0);
@@ -125,6 +197,7 @@ void hdspe_mixer_update_channel_map(struct hdspe* hdspe)
 			hdspe_write_pb_gain(hdspe, i, i, HDSPE_UNITY_GAIN);
 #endif /*DAW_MODE*/
 		}
+		spin_unlock(&hdspe->mixer_lock);
 	}
 	
 	/* mute all unused capture channels */
@@ -136,6 +209,7 @@ void hdspe_mixer_update_channel_map(struct hdspe* hdspe)
 		used[c] = true;
 	}
 	for (i = 0; i < HDSPE_MIXER_CHANNELS; i ++) {	
+		spin_lock(&hdspe->mixer_lock);
 		if (!used[i]) {
 			for (j = 0; j < HDSPE_MIXER_CHANNELS; j ++) {
 				hdspe_write_in_gain(hdspe, j, i, 0);
@@ -145,7 +219,10 @@ void hdspe_mixer_update_channel_map(struct hdspe* hdspe)
 			hdspe_write_in_gain(hdspe, i, i, HDSPE_UNITY_GAIN);
 #endif /*PASSTHROUGH_MODE*/
 		}		
+		spin_unlock(&hdspe->mixer_lock);
 	}
+
+	hdspe_notify_mixer_rows(hdspe);
 }
 
 static void hdspe_clear_mixer(struct hdspe * hdspe, u16 sgain)
@@ -162,9 +239,11 @@ static void hdspe_clear_mixer(struct hdspe * hdspe, u16 sgain)
 
 	for (i = 0; i < HDSPE_MIXER_CHANNELS; i++)
 		for (j = 0; j < HDSPE_MIXER_CHANNELS; j++) {
-			hdspe_write_in_gain(hdspe, i, j, gain);
-			hdspe_write_pb_gain(hdspe, i, j, gain);
-		}	
+			hdspe->mixer->ch[i].in[j] = gain;
+			hdspe->mixer->ch[i].pb[j] = gain;
+		}
+
+	hdspe_write_mixer(hdspe);
 }
 
 #define HDSPE_MIXER(xname, xindex) \
@@ -209,7 +288,7 @@ static int snd_hdspe_get_mixer(struct snd_kcontrol *kcontrol,
 	else if (destination >= HDSPE_MAX_CHANNELS)
 		destination = HDSPE_MAX_CHANNELS - 1;
 
-	spin_lock_irq(&hdspe->lock);
+	spin_lock(&hdspe->mixer_lock);
 	if (source >= HDSPE_MAX_CHANNELS)
 		ucontrol->value.integer.value[2] =
 		    hdspe_read_pb_gain(hdspe, destination,
@@ -218,7 +297,7 @@ static int snd_hdspe_get_mixer(struct snd_kcontrol *kcontrol,
 		ucontrol->value.integer.value[2] =
 		    hdspe_read_in_gain(hdspe, destination, source);
 
-	spin_unlock_irq(&hdspe->lock);
+	spin_unlock(&hdspe->mixer_lock);
 
 	return 0;
 }
@@ -245,7 +324,7 @@ static int snd_hdspe_put_mixer(struct snd_kcontrol *kcontrol,
 
 	gain = ucontrol->value.integer.value[2];
 
-	spin_lock_irq(&hdspe->lock);
+	spin_lock(&hdspe->mixer_lock);
 
 	if (source >= HDSPE_MAX_CHANNELS)
 		change = gain != hdspe_read_pb_gain(hdspe, destination,
@@ -264,7 +343,10 @@ static int snd_hdspe_put_mixer(struct snd_kcontrol *kcontrol,
 			hdspe_write_in_gain(hdspe, destination, source,
 					    gain);
 	}
-	spin_unlock_irq(&hdspe->lock);
+	spin_unlock(&hdspe->mixer_lock);
+
+	if (change)
+		hdspe_notify_mixer_rows(hdspe);
 
 	return change;
 }
@@ -305,10 +387,10 @@ static int snd_hdspe_get_playback_mixer(struct snd_kcontrol *kcontrol,
 	if (snd_BUG_ON(channel < 0 || channel >= HDSPE_MAX_CHANNELS))
 		return -EINVAL;
 
-	spin_lock_irq(&hdspe->lock);
+	spin_lock(&hdspe->mixer_lock);
 	ucontrol->value.integer.value[0] =
 	  (hdspe_read_pb_gain(hdspe, channel, channel)*64)/HDSPE_UNITY_GAIN;
-	spin_unlock_irq(&hdspe->lock);
+	spin_unlock(&hdspe->mixer_lock);
 
 	return 0;
 }
@@ -331,19 +413,114 @@ static int snd_hdspe_put_playback_mixer(struct snd_kcontrol *kcontrol,
 
 	gain = ucontrol->value.integer.value[0]*HDSPE_UNITY_GAIN/64;
 
-	spin_lock_irq(&hdspe->lock);
+	spin_lock(&hdspe->mixer_lock);
 	change =
 	    gain != hdspe_read_pb_gain(hdspe, channel,
 				       channel);
 	if (change)
 		hdspe_write_pb_gain(hdspe, channel, channel,
 				    gain);
-	spin_unlock_irq(&hdspe->lock);
+	spin_unlock(&hdspe->mixer_lock);
+
+	if (change)
+		hdspe_notify_mixer_rows(hdspe);
+
 	return change;
 }
 
 static struct snd_kcontrol_new snd_hdspe_playback_mixer = HDSPE_PLAYBACK_MIXER;
 
+/* The matrix mixer rows: one control per output channel, the index,
+ * with the input faders followed by the software playback faders, as
+ * in struct hdspe_channelfader. Gains are linear, HDSPE_UNITY_GAIN at
+ * 0 dB. */
+
+static const DECLARE_TLV_DB_LINEAR(db_scale_hdspe_gain, TLV_DB_GAIN_MUTE, 602);
+
+#define HDSPE_MIXER_ROW \
+{	.iface = SNDRV_CTL_ELEM_IFACE_MIXER, \
+	.name = "Matrix Playback Volume", \
+	.access = SNDRV_CTL_ELEM_ACCESS_READWRITE | \
+		SNDRV_CTL_ELEM_ACCESS_VOLATILE | \
+		SNDRV_CTL_ELEM_ACCESS_TLV_READ, \
+	.info = snd_hdspe_info_mixer_row, \
+	.get = snd_hdspe_get_mixer_row, \
+	.put = snd_hdspe_put_mixer_row, \
+	.tlv = { .p = db_scale_hdspe_gain } \
+}
+
+static int snd_hdspe_info_mixer_row(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 2 * HDSPE_MIXER_CHANNELS;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = 65535;
+	uinfo->value.integer.step = 1;
+	return 0;
+}
+
+static int snd_hdspe_get_mixer_row(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *ucontrol)
+{
+	struct hdspe *hdspe = snd_kcontrol_chip(kcontrol);
+	unsigned int row = ucontrol->id.index;
+	int i;
+
+	if (snd_BUG_ON(row >= HDSPE_MIXER_CHANNELS))
+		return -EINVAL;
+
+	spin_lock(&hdspe->mixer_lock);
+	for (i = 0; i < HDSPE_MIXER_CHANNELS; i++) {
+		ucontrol->value.integer.value[i] =
+			hdspe->mixer->ch[row].in[i];
+		ucontrol->value.integer.value[HDSPE_MIXER_CHANNELS + i] =
+			hdspe->mixer->ch[row].pb[i];
+	}
+	spin_unlock(&hdspe->mixer_lock);
+
+	return 0;
+}
+
+static int snd_hdspe_put_mixer_row(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *ucontrol)
+{
+	struct hdspe *hdspe = snd_kcontrol_chip(kcontrol);
+	unsigned int row = ucontrol->id.index;
+	bool changed_pb[HDSPE_MAX_CHANNELS] = { false };
+	int changed = 0;
+	int i;
+
+	if (snd_BUG_ON(row >= HDSPE_MIXER_CHANNELS))
+		return -EINVAL;
+
+	if (!snd_hdspe_use_is_exclusive(hdspe))
+		return -EBUSY;
+
+	for (i = 0; i < 2 * HDSPE_MIXER_CHANNELS; i++) {
+		long gain = ucontrol->value.integer.value[i];
+		if (gain < 0 || gain > 65535)
+			return -EINVAL;
+	}
+
+	spin_lock(&hdspe->mixer_lock);
+	for (i = 0; i < 2 * HDSPE_MIXER_CHANNELS; i++)
+		changed += hdspe_write_gain(hdspe, row, i,
+					    ucontrol->value.integer.value[i],
+					    changed_pb);
+	spin_unlock(&hdspe->mixer_lock);
+
+	if (changed > 0) {
+		/* The ALSA core notifies this control itself. */
+		clear_bit(row, hdspe->mixer_rows_changed);
+		hdspe_notify_mixer(hdspe, changed_pb);
+	}
+
+	return changed > 0;
+}
+
+static struct snd_kcontrol_new snd_hdspe_mixer_row = HDSPE_MIXER_ROW;
+
 static int hdspe_update_simple_mixer_controls(struct hdspe * hdspe)
 {
 	int i;
@@ -391,8 +568,8 @@ int hdspe_create_mixer_controls(struct hdspe* hdspe)
 	int err;
 	struct snd_kcontrol *kctl;
 
-	err = hdspe_add_controls(hdspe, ARRAY_SIZE(snd_hdspe_controls_mixer),
-				 snd_hdspe_controls_mixer);
+	err = hdspe_add_control_id(hdspe, &snd_hdspe_controls_mixer[0],
+				   &hdspe->cid.mixer);
 	if (err < 0)
 		return err;
 
@@ -409,10 +586,509 @@ int hdspe_create_mixer_controls(struct hdspe* hdspe)
 	}
 
 	hdspe_update_simple_mixer_controls(hdspe);
+
+	/* create the matrix mixer row controls, for all hardware output
+	 * channels used at single speed */
+	limit = 0;
+	for (idx = 0; idx < hdspe->t.ss_out_channels; ++idx) {
+		int c = hdspe->t.channel_map_out_ss[idx];
+		if (c >= 0 && c + 1 > limit)
+			limit = c + 1;
+	}
+	for (idx = 0; idx < limit; ++idx) {
+		snd_hdspe_mixer_row.index = idx;
+		kctl = snd_ctl_new1(&snd_hdspe_mixer_row, hdspe);
+		err = snd_ctl_add(hdspe->card, kctl);
+		if (err < 0)
+			return err;
+		hdspe->mixer_row_ctls[idx] = kctl;
+	}
 	
 	return 0;
 }
 
+/* Notify the Mixer control element, and the simple playback mixer
+ * controls for which the diagonal playback fader is in changed_pb. */
+void hdspe_notify_mixer(struct hdspe* hdspe, const bool* changed_pb)
+{
+	int i;
+
+	snd_ctl_notify(hdspe->card, SNDRV_CTL_EVENT_MASK_VALUE,
+		       hdspe->cid.mixer);
+	hdspe_notify_mixer_rows(hdspe);
+
+	for (i = 0; i < HDSPE_MAX_CHANNELS; i++) {
+		if (changed_pb[i] && hdspe->playback_mixer_ctls[i])
+			snd_ctl_notify(hdspe->card, SNDRV_CTL_EVENT_MASK_VALUE,
+				       &hdspe->playback_mixer_ctls[i]->id);
+	}
+}
+
+int hdspe_set_mixer_gain(struct hdspe* hdspe, unsigned int dest,
+			 unsigned int source, u16 gain, bool* changed_pb)
+{
+	int changed;
+
+	spin_lock(&hdspe->mixer_lock);
+	changed = hdspe_write_gain(hdspe, dest, source, gain, changed_pb);
+	spin_unlock(&hdspe->mixer_lock);
+
+	return changed;
+}
+
+int hdspe_set_mixer(struct hdspe* hdspe, const struct hdspe_mixer_set* req)
+{
+	const u32 max_cells = HDSPE_MIXER_CHANNELS * 2 * HDSPE_MIXER_CHANNELS;
+	struct hdspe_mixer_cell *cells = NULL;
+	struct hdspe_mixer_row *rows = NULL;
+	bool changed_pb[HDSPE_MAX_CHANNELS] = { false };
+	int changed = 0;
+	u32 i, j;
+
+	if (req->cell_count > max_cells ||
+	    req->row_count > HDSPE_MIXER_CHANNELS)
+		return -EINVAL;
+
+	if (!snd_hdspe_use_is_exclusive(hdspe))
+		return -EBUSY;
+
+	if (req->cell_count > 0) {
+		cells = vmemdup_user(u64_to_user_ptr(req->cells),
+				     req->cell_count * sizeof(*cells));
+		if (IS_ERR(cells))
+			return PTR_ERR(cells);
+	}
+
+	if (req->row_count > 0) {
+		rows = vmemdup_user(u64_to_user_ptr(req->rows),
+				    req->row_count * sizeof(*rows));
+		if (IS_ERR(rows)) {
+			kvfree(cells);
+			return PTR_ERR(rows);
+		}
+	}
+
+	/* Check everything before changing anything. */
+	for (i = 0; i < req->cell_count; i++) {
+		if (cells[i].destination >= HDSPE_MIXER_CHANNELS ||
+		    cells[i].source >= 2 * HDSPE_MIXER_CHANNELS ||
+		    cells[i].gain > 0xFFFF) {
+			changed = -EINVAL;
+			goto out;
+		}
+	}
+	for (i = 0; i < req->row_count; i++) {
+		if (rows[i].destination >= HDSPE_MIXER_CHANNELS) {
+			changed = -EINVAL;
+			goto out;
+		}
+		for (j = 0; j < HDSPE_MIXER_CHANNELS; j++) {
+			if (rows[i].faders.in[j] > 0xFFFF ||
+			    rows[i].faders.pb[j] > 0xFFFF) {
+				changed = -EINVAL;
+				goto out;
+			}
+		}
+	}
+
+	/* The mixer lock is taken per row, and per row worth of cells,
+	 * in order to bound the time it is held. */
+	for (i = 0; i < req->row_count; i++) {
+		unsigned int dest = rows[i].destination;
+		spin_lock(&hdspe->mixer_lock);
+		for (j = 0; j < HDSPE_MIXER_CHANNELS; j++) {
+			changed += hdspe_write_gain(hdspe, dest, j,
+						    rows[i].faders.in[j],
+						    changed_pb);
+			changed += hdspe_write_gain(hdspe, dest,
+						    HDSPE_MIXER_CHANNELS + j,
+						    rows[i].faders.pb[j],
+						    changed_pb);
+		}
+		spin_unlock(&hdspe->mixer_lock);
+	}
+
+	for (i = 0; i < req->cell_count; i += 2 * HDSPE_MIXER_CHANNELS) {
+		u32 end = min_t(u32, i + 2 * HDSPE_MIXER_CHANNELS,
+				req->cell_count);
+		spin_lock(&hdspe->mixer_lock);
+		for (j = i; j < end; j++)
+			changed += hdspe_write_gain(hdspe,
+						    cells[j].destination,
+						    cells[j].source,
+						    cells[j].gain, changed_pb);
+		spin_unlock(&hdspe->mixer_lock);
+	}
+
+	if (changed > 0)
+		hdspe_notify_mixer(hdspe, changed_pb);
+
+out:
+	kvfree(rows);
+	kvfree(cells);
+	return changed;
+}
+
+/* ------------------ Mixer scenes -------------------- */
+
+static bool hdspe_mixer_valid(const struct hdspe_mixer* mixer)
+{
+	int i, j;
+
+	for (i = 0; i < HDSPE_MIXER_CHANNELS; i++)
+		for (j = 0; j < HDSPE_MIXER_CHANNELS; j++)
+			if (mixer->ch[i].in[j] > 0xFFFF ||
+			    mixer->ch[i].pb[j] > 0xFFFF)
+				return false;
+	return true;
+}
+
+int hdspe_store_mixer_scene(struct hdspe* hdspe,
+			    const struct hdspe_mixer_scene* req)
+{
+	struct hdspe_mixer_scene_slot *scene;
+
+	if (req->index >= HDSPE_MIXER_SCENES)
+		return -EINVAL;
+
+	scene = kvzalloc(sizeof(*scene), GFP_KERNEL);
+	if (!scene)
+		return -ENOMEM;
+
+	strscpy(scene->name, req->name, sizeof(scene->name));
+
+	if (req->mixer) {
+		if (copy_from_user(&scene->mixer,
+				   u64_to_user_ptr(req->mixer),
+				   sizeof(scene->mixer))) {
+			kvfree(scene);
+			return -EFAULT;
+		}
+		if (!hdspe_mixer_valid(&scene->mixer)) {
+			kvfree(scene);
+			return -EINVAL;
+		}
+	} else {
+		spin_lock(&hdspe->mixer_lock);
+		memcpy(&scene->mixer, hdspe->mixer, sizeof(scene->mixer));
+		spin_unlock(&hdspe->mixer_lock);
+	}
+
+	mutex_lock(&hdspe->mixer_scene_mutex);
+	swap(hdspe->mixer_scenes[req->index], scene);
+	mutex_unlock(&hdspe->mixer_scene_mutex);
+
+	kvfree(scene);   /* the scene previously stored at index */
+	return 0;
+}
+
+int hdspe_get_mixer_scene(struct hdspe* hdspe, struct hdspe_mixer_scene* req)
+{
+	struct hdspe_mixer_scene_slot *scene;
+	int err = 0;
+
+	if (req->index >= HDSPE_MIXER_SCENES)
+		return -EINVAL;
+
+	mutex_lock(&hdspe->mixer_scene_mutex);
+	scene = hdspe->mixer_scenes[req->index];
+	if (!scene) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	memcpy(req->name, scene->name, sizeof(req->name));
+	if (req->mixer && copy_to_user(u64_to_user_ptr(req->mixer),
+				       &scene->mixer, sizeof(scene->mixer)))
+		err = -EFAULT;
+
+out:
+	mutex_unlock(&hdspe->mixer_scene_mutex);
+	return err;
+}
+
+/* Write the faders of output row dest that differ from the scene, if
+ * decreasing (up = false) or increasing (up = true). */
+static int hdspe_recall_mixer_row(struct hdspe* hdspe,
+				  const struct hdspe_mixer* scene,
+				  unsigned int dest, bool up, bool* changed_pb)
+{
+	const struct hdspe_channelfader *to = &scene->ch[dest];
+	const struct hdspe_channelfader *from = &hdspe->mixer->ch[dest];
+	int changed = 0;
+	int j;
+
+	for (j = 0; j < HDSPE_MIXER_CHANNELS; j++) {
+		if ((to->in[j] > from->in[j]) == up &&
+		    to->in[j] != from->in[j])
+			changed += hdspe_write_gain(hdspe, dest, j,
+						    to->in[j], changed_pb);
+		if ((to->pb[j] > from->pb[j]) == up &&
+		    to->pb[j] != from->pb[j])
+			changed += hdspe_write_gain(hdspe, dest,
+						    HDSPE_MIXER_CHANNELS + j,
+						    to->pb[j], changed_pb);
+	}
+
+	return changed;
+}
+
+int hdspe_recall_mixer_scene(struct hdspe* hdspe,
+			     struct hdspe_mixer_scene_recall* req)
+{
+	struct hdspe_mixer_scene_slot *scene;
+	bool changed_pb[HDSPE_MAX_CHANNELS] = { false };
+	int changed = 0;
+	ktime_t start;
+	int pass, i;
+
+	if (req->index >= HDSPE_MIXER_SCENES)
+		return -EINVAL;
+
+	if (!snd_hdspe_use_is_exclusive(hdspe))
+		return -EBUSY;
+
+	mutex_lock(&hdspe->mixer_scene_mutex);
+	scene = hdspe->mixer_scenes[req->index];
+	if (!scene) {
+		mutex_unlock(&hdspe->mixer_scene_mutex);
+		return -ENOENT;
+	}
+
+	/* A scene replaces the whole mixer: stop all gain ramps, or they
+	 * would carry on towards their old targets. */
+	start = ktime_get();
+	spin_lock(&hdspe->mixer_lock);
+	for (i = 0; i < HDSPE_MIXER_RAMPS; i++)
+		hdspe->mixer_ramps[i].steps = 0;
+	hdspe->mixer_ramps_active = 0;
+	spin_unlock(&hdspe->mixer_lock);
+
+	/* All decreasing gains first, then all increasing ones. The mixer
+	 * lock is taken per row, in order to bound the time it is held. */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < HDSPE_MIXER_CHANNELS; i++) {
+			spin_lock(&hdspe->mixer_lock);
+			changed += hdspe_recall_mixer_row(hdspe, &scene->mixer,
+							  i, pass == 1,
+							  changed_pb);
+			spin_unlock(&hdspe->mixer_lock);
+		}
+	}
+	req->duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+	req->changed = changed;
+
+	dev_dbg(hdspe->card->dev, "%s: scene %u '%s': %d faders in %llu ns.\n",
+		__func__, req->index, scene->name, changed, req->duration);
+	mutex_unlock(&hdspe->mixer_scene_mutex);
+
+	if (changed > 0)
+		hdspe_notify_mixer(hdspe, changed_pb);
+
+	return 0;
+}
+
+/* ------------------ Gain ramps -------------------- */
+
+/* 2^(2^-k), k = 1 .. 16, 2.30 fixed point */
+static const u32 hdspe_exp2_frac[16] = {
+	1518500250, 1276901417, 1170923762, 1121280436,
+	1097253708, 1085434106, 1079572136, 1076653033,
+	1075196443, 1074468888, 1074105294, 1073923544,
+	1073832680, 1073787251, 1073764537, 1073753181
+};
+
+/* log2(gain), 16.16 fixed point. Gain 0 is treated as 1 (-90 dB). */
+static s32 hdspe_gain_log2(u32 gain)
+{
+	int i = gain > 1 ? fls(gain) - 1 : 0;
+	u64 x = (u64)max(gain, 1U) << (31 - i);	/* mantissa, 1.31 */
+	s32 level = i << 16;
+	int b;
+
+	for (b = 1 << 15; b; b >>= 1) {
+		x = (x * x) >> 31;
+		if (x >= (1ULL << 32)) {
+			x >>= 1;
+			level |= b;
+		}
+	}
+	return level;
+}
+
+/* Inverse of hdspe_gain_log2(), for level >= 0. */
+static u16 hdspe_gain_exp2(s32 level)
+{
+	u64 x = 1U << 30;
+	int k;
+
+	for (k = 0; k < 16; k++)
+		if (level & (1 << (15 - k)))
+			x = (x * hdspe_exp2_frac[k]) >> 30;
+	x = ((x << (level >> 16)) + (1U << 29)) >> 30;
+	return min_t(u64, x, 0xFFFF);
+}
+
+static u32 hdspe_read_gain(struct hdspe* hdspe, unsigned int dest,
+			   unsigned int source)
+{
+	return source < HDSPE_MIXER_CHANNELS ?
+		hdspe->mixer->ch[dest].in[source] :
+		hdspe->mixer->ch[dest].pb[source - HDSPE_MIXER_CHANNELS];
+}
+
+static struct hdspe_mixer_ramp_state *hdspe_find_ramp(struct hdspe* hdspe,
+						      unsigned int dest,
+						      unsigned int source)
+{
+	struct hdspe_mixer_ramp_state *r;
+
+	for (r = hdspe->mixer_ramps;
+	     r < hdspe->mixer_ramps + HDSPE_MIXER_RAMPS; r++)
+		if (r->steps > 0 && r->destination == dest &&
+		    r->source == source)
+			return r;
+	return NULL;
+}
+
+int hdspe_ramp_mixer(struct hdspe* hdspe, const struct hdspe_mixer_ramps* req)
+{
+	struct hdspe_mixer_ramp *ramps;
+	bool changed_pb[HDSPE_MAX_CHANNELS] = { false };
+	int changed = 0, needed = 0, free_slots = 0;
+	u32 rate, period;
+	u32 i;
+	int err = 0;
+
+	if (req->count == 0)
+		return 0;
+	if (req->count > HDSPE_MIXER_RAMPS)
+		return -EINVAL;
+
+	if (!snd_hdspe_use_is_exclusive(hdspe))
+		return -EBUSY;
+
+	ramps = vmemdup_user(u64_to_user_ptr(req->ramps),
+			     req->count * sizeof(*ramps));
+	if (IS_ERR(ramps))
+		return PTR_ERR(ramps);
+
+	for (i = 0; i < req->count; i++) {
+		if (ramps[i].destination >= HDSPE_MIXER_CHANNELS ||
+		    ramps[i].source >= 2 * HDSPE_MIXER_CHANNELS ||
+		    ramps[i].gain > 0xFFFF ||
+		    ramps[i].duration > HDSPE_MIXER_RAMP_MAX_DURATION) {
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	rate = hdspe_read_system_sample_rate(hdspe);
+	period = max(hdspe->period_size, 1U);
+
+	spin_lock(&hdspe->mixer_lock);
+
+	/* Check there are enough free slots before changing anything. */
+	for (i = 0; i < HDSPE_MIXER_RAMPS; i++)
+		if (hdspe->mixer_ramps[i].steps == 0)
+			free_slots++;
+	for (i = 0; i < req->count; i++)
+		if (ramps[i].duration > 0 &&
+		    !hdspe_find_ramp(hdspe, ramps[i].destination,
+				     ramps[i].source))
+			needed++;
+	if (needed > free_slots) {
+		spin_unlock(&hdspe->mixer_lock);
+		err = -ENOSPC;
+		goto out;
+	}
+
+	for (i = 0; i < req->count; i++) {
+		unsigned int dest = ramps[i].destination;
+		unsigned int source = ramps[i].source;
+		struct hdspe_mixer_ramp_state *r =
+			hdspe_find_ramp(hdspe, dest, source);
+		u32 steps = DIV_ROUND_UP_ULL((u64)ramps[i].duration * rate,
+					     1000ULL * period);
+
+		if (steps == 0) {
+			if (r) {
+				r->steps = 0;
+				hdspe->mixer_ramps_active--;
+			}
+			changed += hdspe_write_gain(hdspe, dest, source,
+						    ramps[i].gain, changed_pb);
+			continue;
+		}
+
+		if (!r) {
+			/* there is one, checked above */
+			for (r = hdspe->mixer_ramps; r->steps > 0; r++)
+				;
+			hdspe->mixer_ramps_active++;
+		}
+		r->destination = dest;
+		r->source = source;
+		r->target = ramps[i].gain;
+		r->gain = hdspe_read_gain(hdspe, dest, source);
+		r->level = hdspe_gain_log2(r->gain);
+		r->steps = steps;
+	}
+
+	spin_unlock(&hdspe->mixer_lock);
+
+	if (changed > 0)
+		hdspe_notify_mixer(hdspe, changed_pb);
+
+out:
+	kvfree(ramps);
+	return err;
+}
+
+void hdspe_mixer_ramp_period(struct hdspe* hdspe)
+{
+	bool changed_pb[HDSPE_MAX_CHANNELS] = { false };
+	bool finished = false;
+	int i;
+
+	if (READ_ONCE(hdspe->mixer_ramps_active) == 0)
+		return;
+
+	spin_lock(&hdspe->mixer_lock);
+	for (i = 0; i < HDSPE_MIXER_RAMPS; i++) {
+		struct hdspe_mixer_ramp_state *r = &hdspe->mixer_ramps[i];
+		u16 gain;
+
+		if (r->steps == 0)
+			continue;
+
+		/* Continue from the current gain if written meanwhile. */
+		gain = hdspe_read_gain(hdspe, r->destination, r->source);
+		if (gain != r->gain)
+			r->level = hdspe_gain_log2(gain);
+
+		if (r->steps > 1) {
+			r->level += (hdspe_gain_log2(r->target) - r->level) /
+				(s32)r->steps;
+			r->gain = hdspe_gain_exp2(r->level);
+		} else {
+			r->gain = r->target;
+		}
+		hdspe_write_gain(hdspe, r->destination, r->source, r->gain,
+				 changed_pb);
+
+		if (--r->steps == 0) {
+			hdspe->mixer_ramps_active--;
+			finished = true;
+		}
+	}
+	spin_unlock(&hdspe->mixer_lock);
+
+	/* Notify at the end of ramps only. */
+	if (finished)
+		hdspe_notify_mixer(hdspe, changed_pb);
+}
+
 int hdspe_init_mixer(struct hdspe* hdspe)
 {
 	dev_dbg(hdspe->card->dev, "kmalloc Mixer memory of %zd Bytes\n",
@@ -420,6 +1096,8 @@ int hdspe_init_mixer(struct hdspe* hdspe)
 	hdspe->mixer = kzalloc(sizeof(*hdspe->mixer), GFP_KERNEL);
 	if (!hdspe->mixer)
 		return -ENOMEM;
+
+	mutex_init(&hdspe->mixer_scene_mutex);
 	
 	hdspe_clear_mixer(hdspe, 0 * HDSPE_UNITY_GAIN);
 	
@@ -428,5 +1106,11 @@ int hdspe_init_mixer(struct hdspe* hdspe)
 
 void hdspe_terminate_mixer(struct hdspe* hdspe)
 {
+	int i;
+
+	for (i = 0; i < HDSPE_MIXER_SCENES; i++) {
+		kvfree(hdspe->mixer_scenes[i]);
+		hdspe->mixer_scenes[i] = NULL;
+	}
         kfree(hdspe->mixer);	
 }
@@ -12,6 +12,11 @@
 #include "hdspe_core.h"
 
 #include <linux/pci.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
 
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
@@ -50,22 +55,25 @@ static int snd_hdspe_preallocate_memory(struct hdspe *hdspe)
 }
 
 /* Inform the card what DMA addresses to use for the indicated channel.
- * Each channel got 16 4K pages allocated for DMA transfers. We map the
- * channels the same way for all speeds: DMA channel 0 at the start
- * of the buffer, DMA channel 1 next, a.s.o. Audio data for some logical
- * channels (e.g. ADAT) may appear in different DMA channels, depending
- * on speed mode. We catch that by setting the buffer offsets for each
- * logical channel appropriately, depending on current speed mode, in
- * snd_hdspe_channel_info(). */
+ * Each channel got 16 4K pages allocated for DMA transfers, at channel
+ * buffer slot 'slot' in the substreams DMA buffer. For the main PCM device,
+ * we map the channels the same way for all speeds: DMA channel 0 at the
+ * start of the buffer, DMA channel 1 next, a.s.o. Audio data for some
+ * logical channels (e.g. ADAT) may appear in different DMA channels,
+ * depending on speed mode. We catch that by setting the buffer offsets for
+ * each logical channel appropriately, depending on current speed mode, in
+ * snd_hdspe_channel_info(). Port PCM devices only have buffer slots for
+ * their own channels, see snd_hdspe_port_hw_params(). */
 static void hdspe_set_channel_dma_addr(struct hdspe *hdspe,
 				       struct snd_pcm_substream *substream,
 				       unsigned int reg,
-				       int channel)
+				       int channel, int slot)
 {
 	int i;
-	for (i = channel * 16; i < channel * 16 + 16; i++) {
-		hdspe_write(hdspe, reg + 4 * i,
-			    snd_pcm_sgbuf_get_addr(substream, 4096 * i));
+	for (i = 0; i < 16; i++) {
+		hdspe_write(hdspe, reg + 4 * (channel * 16 + i),
+			    snd_pcm_sgbuf_get_addr(substream,
+				slot * HDSPE_CHANNEL_BUFFER_BYTES + 4096 * i));
 	}
 }
 
@@ -80,8 +88,119 @@ static inline void snd_hdspe_enable_out(struct hdspe * hdspe, int i, int v)
 	hdspe_write(hdspe, HDSPE_outputEnableBase + (4 * i), v);
 }
 
+/* Program and enable DMA channel c for the substream, using channel
+ * buffer slot 'slot' of the substreams DMA buffer. DMA buffers persist
+ * for the lifetime of the card, so the page address table of a channel
+ * only needs to be written when the channel moves to another buffer
+ * slot, and the enable register only when the channel was disabled.
+ * The channel must have been claimed with hdspe_claim_dma_channels(). */
+static void hdspe_enable_dma_channel(struct hdspe *hdspe,
+				     struct snd_pcm_substream *substream,
+				     int c, int slot)
+{
+	int stream = substream->stream;
+	bool playback = (stream == SNDRV_PCM_STREAM_PLAYBACK);
+	unsigned char *area = substream->runtime->dma_area
+		+ slot * HDSPE_CHANNEL_BUFFER_BYTES;
+
+	if (hdspe->dma_page_table[stream][c] != area) {
+		hdspe_set_channel_dma_addr(hdspe, substream,
+					   playback ? HDSPE_pageAddressBufferOut
+					   : HDSPE_pageAddressBufferIn,
+					   c, slot);
+		hdspe->dma_page_table[stream][c] = area;
+	}
+
+	if (!hdspe->dma_enabled[stream][c]) {
+		if (playback)
+			snd_hdspe_enable_out(hdspe, c, 1);
+		else
+			snd_hdspe_enable_in(hdspe, c, 1);
+		hdspe->dma_enabled[stream][c] = true;
+	}
+}
+
+/* Disable the DMA channels in mask for the given stream direction. */
+static void hdspe_disable_dma_channels(struct hdspe *hdspe, int stream,
+				       u64 mask)
+{
+	int c;
+	for (c = 0; c < HDSPE_MAX_CHANNELS; c++) {
+		if (!(mask & (1ULL << c)) || !hdspe->dma_enabled[stream][c])
+			continue;
+		if (stream == SNDRV_PCM_STREAM_PLAYBACK)
+			snd_hdspe_enable_out(hdspe, c, 0);
+		else
+			snd_hdspe_enable_in(hdspe, c, 0);
+		hdspe->dma_enabled[stream][c] = false;
+	}
+}
+
+/* DMA channels in use for the given stream direction by the main PCM
+ * device and port PCM devices, except by the one owning *mine. 
+ * Caller holds hdspe->lock. */
+static u64 hdspe_dma_channels_in_use(struct hdspe *hdspe, int stream,
+				     u64 *mine)
+{
+	u64 mask = 0;
+	int i;
+
+	if (&hdspe->dma_channels[stream] != mine)
+		mask |= hdspe->dma_channels[stream];
+	for (i = 0; i < hdspe->port_count; i++) {
+		if (&hdspe->ports[i].dma_channels[stream] != mine)
+			mask |= hdspe->ports[i].dma_channels[stream];
+	}
+	return mask;
+}
+
+/* Claim the DMA channels in mask for the stream owning *mine. Fails with
+ * -EBUSY if any of them is in use by another PCM device. Channels 
+ * previously claimed, but not in mask anymore, are disabled. */
+static int hdspe_claim_dma_channels(struct hdspe *hdspe, int stream,
+				    u64 *mine, u64 mask)
+{
+	u64 released;
+
+	spin_lock_irq(&hdspe->lock);
+	if (mask & hdspe_dma_channels_in_use(hdspe, stream, mine)) {
+		spin_unlock_irq(&hdspe->lock);
+		return -EBUSY;
+	}
+	released = *mine & ~mask;
+	*mine = mask;
+	spin_unlock_irq(&hdspe->lock);
+
+	hdspe_disable_dma_channels(hdspe, stream, released);
+	return 0;
+}
+
+/* Release all DMA channels claimed by the stream owning *mine. */
+static void hdspe_release_dma_channels(struct hdspe *hdspe, int stream,
+				       u64 *mine)
+{
+	u64 released;
+
+	spin_lock_irq(&hdspe->lock);
+	released = *mine;
+	*mine = 0;
+	spin_unlock_irq(&hdspe->lock);
+
+	hdspe_disable_dma_channels(hdspe, stream, released);
+}
+
 /* ------------------------------------------------------- */
 
+/* Returns the port a substream of a port PCM device belongs to, or NULL
+ * for substreams of the main PCM device (device 0). */
+static inline struct hdspe_port *hdspe_substream_port(
+	struct snd_pcm_substream *substream)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	int device = substream->pcm->device;
+	return device > 0 ? &hdspe->ports[device - 1] : NULL;
+}
+
 /**
  * Returns true if the card is a RayDAT / AIO / AIO Pro 
  */
@@ -121,10 +240,10 @@ static void hdspe_set_period_size(struct hdspe* hdspe)
 
 static int hdspe_set_interrupt_interval(struct hdspe *hdspe, unsigned int frames)
 {
+	struct hdspe_event ev = { .type = HDSPE_EVENT_BUFFER_SIZE };
+	u64 t;
 	int n;
 
-	spin_lock_irq(&hdspe->lock);
-
 	if (32 == frames) {
 		/* Special case for new RME cards like RayDAT/AIO which
 		 * support period sizes of 32 samples. Since latency is
@@ -146,15 +265,22 @@ static int hdspe_set_interrupt_interval(struct hdspe *hdspe, unsigned int frames
 		}
 	}
 
+	/* Called with control_mutex held, which nests outside hdspe->lock. */
+	lockdep_assert_held(&hdspe->control_mutex);
+	t = hdspe_irqs_off_begin();
+	spin_lock_irq(&hdspe->lock);
+
 	hdspe->reg.control.common.LAT = n;
 	hdspe_write_control(hdspe);
-
 	hdspe_set_period_size(hdspe);
 
 	spin_unlock_irq(&hdspe->lock);
+	hdspe_irqs_off_end(hdspe, t, __func__);
 
 	snd_ctl_notify(hdspe->card, SNDRV_CTL_EVENT_MASK_VALUE,
 		       hdspe->cid.buffer_size);
+	ev.buffer_size.frames = hdspe->period_size;
+	hdspe_post_event(hdspe, &ev);
 	
 	return 0;
 }
@@ -167,6 +293,69 @@ snd_pcm_uframes_t hdspe_hw_pointer(struct hdspe *hdspe)
 		& (hdspe->hw_buffer_size - 1);
 }
 
+int hdspe_running_streams(struct hdspe *hdspe)
+{
+	int i, running = hdspe->running;
+
+	for (i = 0; i < hdspe->port_count; i++)
+		running |= hdspe->ports[i].running;
+	return running;
+}
+
+/* Detect periods for which no interrupt was handled, and interrupts that
+ * were handled so late that the hardware is at least half way the next
+ * period, while streams are running. Both are hardware side dropouts,
+ * as opposed to application xruns. The hardware pointer has 16 frames
+ * resolution, so with 32 frame periods an interrupt is late as soon as
+ * the pointer has moved on at all. Called from the interrupt handler,
+ * after updating the frame counter. */
+static void hdspe_check_xruns(struct hdspe *hdspe, u64 last_frame_count)
+{
+	struct hdspe_xruns *x = &hdspe->xruns;
+	int running = hdspe_running_streams(hdspe);
+	int active = running & x->running; /* running at both interrupts */
+	bool changed = false;
+	u32 periods, offset;
+	int s;
+
+	x->running = running;
+	if (!active || hdspe->frame_count <= last_frame_count)
+		return;
+
+	periods = div_u64(hdspe->frame_count - last_frame_count,
+			  hdspe->period_size);
+	offset = hdspe->irq_hw_pointer & (hdspe->period_size - 1);
+
+	for (s = 0; s < 2; s++) {
+		struct hdspe_event ev = { .type = HDSPE_EVENT_XRUN };
+		bool xrun = false;
+
+		if (!(active & (1 << s)))
+			continue;
+		if (periods > 1) {
+			x->missed[s] += periods - 1;
+			x->missed_time[s] = hdspe->irq_time;
+			xrun = true;
+		}
+		if (offset >= hdspe->period_size / 2) {
+			x->late[s]++;
+			x->late_time[s] = hdspe->irq_time;
+			xrun = true;
+		}
+		if (!xrun)
+			continue;
+
+		ev.xrun.stream = s;
+		ev.xrun.missed = x->missed[s];
+		ev.xrun.late = x->late[s];
+		hdspe_post_event(hdspe, &ev);
+		changed = true;
+	}
+
+	if (changed)
+		HDSPE_CTL_NOTIFY(xruns);
+}
+
 /* Called right from the interrupt handler in order to update the frame
  * counter. In absence of xruns, the frame counter increments by
  * hdspe_period_size() frames each period. This routine will correctly
@@ -176,17 +365,21 @@ snd_pcm_uframes_t hdspe_hw_pointer(struct hdspe *hdspe)
  * 16K frames, so about 3 times a second at 48 KHz sampling rate. */
 void hdspe_update_frame_count(struct hdspe* hdspe)
 {
+	u64 last_frame_count = hdspe->frame_count;
 	u32 hw_pointer;
 
 	hw_pointer = le16_to_cpu(hdspe->reg.status0.common.BUF_PTR) << 4;
 	if (hw_pointer < hdspe->last_hw_pointer)
 		hdspe->hw_pointer_wrap_count ++;
 	hdspe->last_hw_pointer = hw_pointer;
+	hdspe->irq_hw_pointer = hw_pointer;
 
 	hdspe->frame_count =
 		(u64)hdspe->hw_pointer_wrap_count * ((1<<16)/4)
 		+ (hw_pointer & ~(hdspe->period_size - 1));
 
+	hdspe_check_xruns(hdspe, last_frame_count);
+
 #ifdef DEBUG_FRAME_COUNT
 	{
 		static u64 last_frame_count =0;
@@ -206,6 +399,103 @@ void hdspe_update_frame_count(struct hdspe* hdspe)
 #endif /*DEBUG_FRAME_COUNT*/
 }
 
+u64 hdspe_irq_frame_pos(struct hdspe* hdspe)
+{
+	return hdspe->frame_count +
+		(hdspe->irq_hw_pointer & (hdspe->period_size - 1));
+}
+
+/* Number of frames the card advanced since the last audio interrupt,
+ * estimated from the time elapsed since and the nominal sample rate.
+ * Clamped to the next period boundary: if the interrupt for it is late,
+ * we rather stall than run ahead of the hardware. */
+static u32 hdspe_frames_since_irq(struct hdspe *hdspe, unsigned int rate)
+{
+	ktime_t time;
+	unsigned int seq;
+	u32 offset;
+	s64 ns;
+	u64 frames;
+
+	do {
+		seq = read_seqcount_begin(&hdspe->irq_seq);
+		time = hdspe->irq_time;
+		offset = hdspe->irq_hw_pointer & (hdspe->period_size - 1);
+	} while (read_seqcount_retry(&hdspe->irq_seq, seq));
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), time));
+	if (ns <= 0 || rate == 0)
+		return 0;
+
+	frames = mul_u64_u32_div(ns, rate, NSEC_PER_SEC);
+	return min_t(u64, frames, hdspe->period_size - offset);
+}
+
+snd_pcm_uframes_t hdspe_pcm_pointer(struct hdspe *hdspe,
+				    struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct hdspe_port *port = hdspe_substream_port(substream);
+	int running = port ? port->running : hdspe->running;
+	union hdspe_status0_reg status0;
+	u32 advance;
+
+	runtime->delay = 0;
+	if (!(running & (1 << substream->stream)))
+		return hdspe_hw_pointer(hdspe);
+
+	switch (hdspe->pointer_mode) {
+	case HDSPE_POINTER_MODE_LIVE:
+		/* Costs a register read, but with 16 frames granularity. */
+		status0 = hdspe_read_status0_nocache(hdspe);
+		return (le16_to_cpu(status0.common.BUF_PTR) << 4)
+			& (hdspe->hw_buffer_size - 1);
+
+	case HDSPE_POINTER_MODE_INTERPOLATED:
+		advance = hdspe_frames_since_irq(hdspe, runtime->rate);
+		return (hdspe_hw_pointer(hdspe) + advance)
+			& (hdspe->hw_buffer_size - 1);
+
+	default:
+		/* Keep the pointer at period granularity, but let
+		 * snd_pcm_delay() account for the frames played or captured
+		 * since the last interrupt. For playback, these frames are
+		 * no longer queued. For capture, they are captured but not
+		 * yet available. */
+		advance = hdspe_frames_since_irq(hdspe, runtime->rate);
+		runtime->delay = substream->stream == SNDRV_PCM_STREAM_PLAYBACK
+			? -(snd_pcm_sframes_t)advance : advance;
+		return hdspe_hw_pointer(hdspe);
+	}
+}
+
+/* Substreams opened with SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP schedule
+ * themselves from the hardware pointer. The card keeps interrupting at
+ * period rate, in order to keep the frame counter and TCO state up to
+ * date, but we do not wake them up. */
+static inline void hdspe_substream_period_elapsed(
+	struct snd_pcm_substream *substream)
+{
+	if (substream && !substream->runtime->no_period_wakeup)
+		snd_pcm_period_elapsed(substream);
+}
+
+void hdspe_pcm_period_elapsed(struct hdspe* hdspe)
+{
+	int i;
+
+	hdspe_substream_period_elapsed(hdspe->capture_substream);
+	hdspe_substream_period_elapsed(hdspe->playback_substream);
+
+	for (i = 0; i < hdspe->port_count; i++) {
+		struct hdspe_port *port = &hdspe->ports[i];
+		hdspe_substream_period_elapsed(
+			port->substream[SNDRV_PCM_STREAM_CAPTURE]);
+		hdspe_substream_period_elapsed(
+			port->substream[SNDRV_PCM_STREAM_PLAYBACK]);
+	}
+}
+
 static inline void hdspe_start_audio(struct hdspe * s)
 {
 	return;   /* we have audio interrupts enabled all the time */
@@ -238,11 +528,423 @@ static void hdspe_silence_playback(struct hdspe *hdspe)
 	}
 }
 
+/*------------------------------------------------------------
+   interleaved and packed format access
+ ------------------------------------------------------------*/
+
+/* The card transfers 32-bit samples, one DMA buffer per channel. Besides
+ * mmap and read/write access in that native format, we offer read/write
+ * access to interleaved S16_LE, S24_3LE and S32_LE data, converted and
+ * (de-)interleaved right here, while copying from/to the application
+ * buffer. This saves the extra copy and conversion pass in the alsa-lib
+ * plug layer. The conversion loops are plain C: kernel FPU/SIMD sections
+ * would cost more than they save at these data rates, and would tie the
+ * driver to one architecture. */
+
+/* Formats the card transfers natively, in any access mode. */
+static inline bool hdspe_is_native_format(snd_pcm_format_t format)
+{
+	return format == SNDRV_PCM_FORMAT_S32_LE ||
+		format == SNDRV_PCM_FORMAT_FLOAT_LE;
+}
+
+/* Start of the DMA buffer for logical channel ch of the substream. */
+static __le32 *hdspe_channel_buffer(struct snd_pcm_substream *substream,
+				    int ch)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	unsigned char *area = substream->runtime->dma_area;
+	int slot = ch;
+
+	if (!hdspe_substream_port(substream))
+		slot = substream->stream == SNDRV_PCM_STREAM_PLAYBACK
+			? hdspe->channel_map_out[ch]
+			: hdspe->channel_map_in[ch];
+
+	return (__le32 *)(area + slot * HDSPE_CHANNEL_BUFFER_BYTES);
+}
+
+/* Convert n samples of width bytes from src, starting at interleaved
+ * sample index idx, to native samples in the channel buffers buf. */
+static void hdspe_write_samples(__le32 **buf, int channels, int width,
+				unsigned long idx, const u8 *src,
+				unsigned long n)
+{
+	unsigned int ch = idx % channels;
+	unsigned long frame = idx / channels;
+
+#define HDSPE_WRITE_SAMPLES(expr)			\
+	for (; n > 0; n--, src += width) {		\
+		buf[ch][frame] = cpu_to_le32(expr);	\
+		if (++ch == channels) {			\
+			ch = 0;				\
+			frame++;			\
+		}					\
+	}
+
+	switch (width) {
+	case 2:
+		HDSPE_WRITE_SAMPLES(((u32)src[0] << 16) | ((u32)src[1] << 24));
+		break;
+	case 3:
+		HDSPE_WRITE_SAMPLES(((u32)src[0] << 8) | ((u32)src[1] << 16) |
+				    ((u32)src[2] << 24));
+		break;
+	default:
+		HDSPE_WRITE_SAMPLES(((u32)src[0] << 0) | ((u32)src[1] << 8) |
+				    ((u32)src[2] << 16) | ((u32)src[3] << 24));
+	}
+#undef HDSPE_WRITE_SAMPLES
+}
+
+/* Inverse of hdspe_write_samples(). */
+static void hdspe_read_samples(__le32 **buf, int channels, int width,
+			       unsigned long idx, u8 *dst,
+			       unsigned long n)
+{
+	unsigned int ch = idx % channels;
+	unsigned long frame = idx / channels;
+	u32 v;
+
+#define HDSPE_READ_SAMPLES(stmt)			\
+	for (; n > 0; n--, dst += width) {		\
+		v = le32_to_cpu(buf[ch][frame]);	\
+		stmt;					\
+		if (++ch == channels) {			\
+			ch = 0;				\
+			frame++;			\
+		}					\
+	}
+
+	switch (width) {
+	case 2:
+		HDSPE_READ_SAMPLES(dst[0] = v >> 16; dst[1] = v >> 24);
+		break;
+	case 3:
+		HDSPE_READ_SAMPLES(dst[0] = v >> 8; dst[1] = v >> 16;
+				   dst[2] = v >> 24);
+		break;
+	default:
+		HDSPE_READ_SAMPLES(dst[0] = v; dst[1] = v >> 8;
+				   dst[2] = v >> 16; dst[3] = v >> 24);
+	}
+#undef HDSPE_READ_SAMPLES
+}
+
+/* Bounce buffer size for user space transfers: a multiple of 2, 3 and 4
+ * bytes, so it always holds whole samples. */
+#define HDSPE_BOUNCE_BYTES	3072
+
+/* Per substream transfer state, runtime->private_data. Allocated at open,
+ * so the copy callbacks need neither the stack nor an allocation. */
+struct hdspe_pcm_xfer {
+	__le32 *buf[HDSPE_MAX_CHANNELS]; /* channel buffers, logical order */
+	u8 bounce[HDSPE_BOUNCE_BYTES];
+};
+
+static void hdspe_pcm_xfer_free(struct snd_pcm_runtime *runtime)
+{
+	kfree(runtime->private_data);
+	runtime->private_data = NULL;
+}
+
+static int hdspe_pcm_xfer_alloc(struct snd_pcm_runtime *runtime)
+{
+	runtime->private_data = kzalloc(sizeof(struct hdspe_pcm_xfer),
+					GFP_KERNEL);
+	if (!runtime->private_data)
+		return -ENOMEM;
+	runtime->private_free = hdspe_pcm_xfer_free;
+	return 0;
+}
+
+/* Look up the channel buffers once, at hw_params() time, when the DMA
+ * buffer and channel map are settled. runtime->channels is not yet set
+ * at that point. */
+static void hdspe_pcm_xfer_setup(struct snd_pcm_substream *substream,
+				 unsigned int channels)
+{
+	struct hdspe_pcm_xfer *x = substream->runtime->private_data;
+	int ch;
+
+	for (ch = 0; ch < channels; ch++)
+		x->buf[ch] = hdspe_channel_buffer(substream, ch);
+}
+
+/* Channel buffers covered by a transfer: in interleaved mode all
+ * channels, in non-interleaved mode only the indicated channel.
+ * Returns the number of channels. */
+static int hdspe_transfer_buffers(struct snd_pcm_substream *substream,
+				  int channel, __le32 ***buf)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct hdspe_pcm_xfer *x = runtime->private_data;
+
+	if (runtime->access != SNDRV_PCM_ACCESS_RW_INTERLEAVED) {
+		*buf = &x->buf[channel];
+		return 1;
+	}
+
+	*buf = x->buf;
+	return runtime->channels;
+}
+
+/* Copy bytes bytes at byte offset pos in the (interleaved or single
+ * channel) runtime buffer from/to the kernel buffer data. */
+static void hdspe_transfer(struct snd_pcm_substream *substream,
+			   int channel, unsigned long pos,
+			   void *data, unsigned long bytes)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int width = snd_pcm_format_physical_width(runtime->format) / 8;
+	__le32 **buf;
+	int channels = hdspe_transfer_buffers(substream, channel, &buf);
+
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		hdspe_write_samples(buf, channels, width, pos / width,
+				    data, bytes / width);
+	else
+		hdspe_read_samples(buf, channels, width, pos / width,
+				   data, bytes / width);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+static int snd_hdspe_copy(struct snd_pcm_substream *substream,
+			  int channel, unsigned long pos,
+			  struct iov_iter *iter, unsigned long bytes)
+{
+	struct hdspe_pcm_xfer *x = substream->runtime->private_data;
+	u8 *bounce = x->bounce;
+	bool playback = (substream->stream == SNDRV_PCM_STREAM_PLAYBACK);
+
+	while (bytes > 0) {
+		unsigned long n = min_t(unsigned long, bytes,
+					HDSPE_BOUNCE_BYTES);
+		if (playback) {
+			if (copy_from_iter(bounce, n, iter) != n)
+				return -EFAULT;
+			hdspe_transfer(substream, channel, pos, bounce, n);
+		} else {
+			hdspe_transfer(substream, channel, pos, bounce, n);
+			if (copy_to_iter(bounce, n, iter) != n)
+				return -EFAULT;
+		}
+		pos += n;
+		bytes -= n;
+	}
+	return 0;
+}
+#else
+static int snd_hdspe_copy_user(struct snd_pcm_substream *substream,
+			       int channel, unsigned long pos,
+			       void __user *data, unsigned long bytes)
+{
+	struct hdspe_pcm_xfer *x = substream->runtime->private_data;
+	u8 *bounce = x->bounce;
+	bool playback = (substream->stream == SNDRV_PCM_STREAM_PLAYBACK);
+
+	while (bytes > 0) {
+		unsigned long n = min_t(unsigned long, bytes,
+					HDSPE_BOUNCE_BYTES);
+		if (playback) {
+			if (copy_from_user(bounce, data, n))
+				return -EFAULT;
+			hdspe_transfer(substream, channel, pos, bounce, n);
+		} else {
+			hdspe_transfer(substream, channel, pos, bounce, n);
+			if (copy_to_user(data, bounce, n))
+				return -EFAULT;
+		}
+		data += n;
+		pos += n;
+		bytes -= n;
+	}
+	return 0;
+}
+
+static int snd_hdspe_copy_kernel(struct snd_pcm_substream *substream,
+				 int channel, unsigned long pos,
+				 void *data, unsigned long bytes)
+{
+	hdspe_transfer(substream, channel, pos, data, bytes);
+	return 0;
+}
+#endif
+
+static int snd_hdspe_fill_silence(struct snd_pcm_substream *substream,
+				  int channel, unsigned long pos,
+				  unsigned long bytes)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int width = snd_pcm_format_physical_width(runtime->format) / 8;
+	__le32 **buf;
+	int channels = hdspe_transfer_buffers(substream, channel, &buf);
+	unsigned long frame = pos / width / channels;
+	unsigned long frames = bytes / width / channels;
+	int ch;
+
+	for (ch = 0; ch < channels; ch++)
+		memset(buf[ch] + frame, 0, frames * 4);
+	return 0;
+}
+
+/* Non-native formats are only available with RW_INTERLEAVED access. */
+static int snd_hdspe_hw_rule_format_access(struct snd_pcm_hw_params *params,
+					   struct snd_pcm_hw_rule *rule)
+{
+	struct snd_mask *a = hw_param_mask(params, SNDRV_PCM_HW_PARAM_ACCESS);
+	struct snd_mask *f = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+	struct snd_mask m;
+
+	if (snd_mask_test(a, (__force unsigned int)
+			  SNDRV_PCM_ACCESS_RW_INTERLEAVED))
+		return 0;
+
+	snd_mask_none(&m);
+	snd_mask_set_format(&m, SNDRV_PCM_FORMAT_S32_LE);
+	snd_mask_set_format(&m, SNDRV_PCM_FORMAT_FLOAT_LE);
+	return snd_mask_refine(f, &m);
+}
+
+static int snd_hdspe_hw_rule_access_format(struct snd_pcm_hw_params *params,
+					   struct snd_pcm_hw_rule *rule)
+{
+	struct snd_mask *a = hw_param_mask(params, SNDRV_PCM_HW_PARAM_ACCESS);
+	struct snd_mask *f = hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+	struct snd_mask m;
+
+	if (snd_mask_test_format(f, SNDRV_PCM_FORMAT_S32_LE) ||
+	    snd_mask_test_format(f, SNDRV_PCM_FORMAT_FLOAT_LE))
+		return 0;
+
+	snd_mask_none(&m);
+	snd_mask_set(&m, (__force unsigned int)SNDRV_PCM_ACCESS_RW_INTERLEAVED);
+	return snd_mask_refine(a, &m);
+}
+
+#ifdef CONFIG_SND_DEBUG
+/* Benchmark the interleaved format conversion: proc file copy_benchmark
+ * reports playback and capture copy throughput, in MB/s of application
+ * data, for each format and a range of channel counts. */
+void hdspe_pcm_proc_copy_benchmark(struct snd_info_entry *entry,
+				   struct snd_info_buffer *buffer)
+{
+	static const int widths[] = { 2, 3, 4 };
+	static const char * const names[] = { "S16_LE", "S24_3LE", "S32_LE" };
+	static const int counts[] = { 2, 8, 16, 32, 64 };
+	const unsigned long frames = 4096, rounds = 16;
+	__le32 **buf;
+	u8 *area, *data;
+	int f, c, ch, r;
+
+	buf = kmalloc_array(HDSPE_MAX_CHANNELS, sizeof(*buf), GFP_KERNEL);
+	area = vzalloc(HDSPE_MAX_CHANNELS * HDSPE_CHANNEL_BUFFER_BYTES);
+	data = vzalloc(frames * HDSPE_MAX_CHANNELS * 4);
+	if (!buf || !area || !data) {
+		snd_iprintf(buffer, "Out of memory.\n");
+		goto done;
+	}
+	for (ch = 0; ch < HDSPE_MAX_CHANNELS; ch++)
+		buf[ch] = (__le32 *)(area + ch * HDSPE_CHANNEL_BUFFER_BYTES);
+
+	snd_iprintf(buffer, "Format\t\tChannels\tPlayback MB/s\tCapture MB/s\n");
+	for (f = 0; f < ARRAY_SIZE(widths); f++) {
+		for (c = 0; c < ARRAY_SIZE(counts); c++) {
+			unsigned long n = frames * counts[c];
+			u64 bytes = (u64)n * widths[f] * rounds;
+			u64 t0, t1, t2;
+
+			t0 = ktime_get_ns();
+			for (r = 0; r < rounds; r++)
+				hdspe_write_samples(buf, counts[c], widths[f],
+						    0, data, n);
+			t1 = ktime_get_ns();
+			for (r = 0; r < rounds; r++)
+				hdspe_read_samples(buf, counts[c], widths[f],
+						   0, data, n);
+			t2 = ktime_get_ns();
+
+			snd_iprintf(buffer, "%s\t\t%d\t\t%llu\t\t%llu\n",
+				    names[f], counts[c],
+				    div64_u64(bytes * 1000, max(t1 - t0, 1ULL)),
+				    div64_u64(bytes * 1000, max(t2 - t1, 1ULL)));
+			cond_resched();
+		}
+	}
+
+done:
+	vfree(data);
+	vfree(area);
+	kfree(buf);
+}
+#endif /*CONFIG_SND_DEBUG*/
+
 static snd_pcm_uframes_t snd_hdspe_hw_pointer(struct snd_pcm_substream
 					      *substream)
 {
 	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
-	return hdspe_hw_pointer(hdspe);
+	return hdspe_pcm_pointer(hdspe, substream);
+}
+
+/* Link time stamps: the system time stamp is the time of the last audio
+ * interrupt, taken right before reading the STATUS0 register, and the
+ * audio time stamp is the frame position the hardware pointer in that
+ * register corresponds to. Both are free of interrupt handling and
+ * scheduling latency, apart from the register read itself. The hardware
+ * pointer has a granularity of 16 frames. LINK_ABSOLUTE time counts
+ * from the start of the card, LINK time from the start of the stream. */
+static int snd_hdspe_get_time_info(
+	struct snd_pcm_substream *substream,
+	struct timespec64 *system_ts, struct timespec64 *audio_ts,
+	struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+	struct snd_pcm_audio_tstamp_report *audio_tstamp_report)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int type = audio_tstamp_config->type_requested;
+	ktime_t time, time_raw;
+	unsigned int seq;
+	u64 pos;
+
+	if (type != SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK &&
+	    type != SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ABSOLUTE) {
+		audio_tstamp_report->actual_type =
+			SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+		return 0;
+	}
+
+	do {
+		seq = read_seqcount_begin(&hdspe->irq_seq);
+		time = hdspe->irq_time;
+		time_raw = hdspe->irq_time_raw;
+		pos = hdspe_irq_frame_pos(hdspe);
+	} while (read_seqcount_retry(&hdspe->irq_seq, seq));
+
+	if (type == SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK) {
+		struct hdspe_port *port = hdspe_substream_port(substream);
+		pos -= port ? port->stream_start_pos[substream->stream]
+			: hdspe->stream_start_pos[substream->stream];
+	}
+
+	switch (runtime->tstamp_type) {
+	case SNDRV_PCM_TSTAMP_TYPE_MONOTONIC_RAW:
+		*system_ts = ktime_to_timespec64(time_raw);
+		break;
+	case SNDRV_PCM_TSTAMP_TYPE_GETTIMEOFDAY:
+		*system_ts = ktime_to_timespec64(ktime_mono_to_real(time));
+		break;
+	default:
+		*system_ts = ktime_to_timespec64(time);
+		break;
+	}
+	*audio_ts = ns_to_timespec64(mul_u64_u32_div(pos, NSEC_PER_SEC,
+						      runtime->rate));
+
+	audio_tstamp_report->actual_type = type;
+	audio_tstamp_report->accuracy_report = 1;
+	audio_tstamp_report->accuracy = 16 * NSEC_PER_SEC / runtime->rate;
+
+	return 0;
 }
 
 static int snd_hdspe_reset(struct snd_pcm_substream *substream)
@@ -286,28 +988,51 @@ static void snd_hdspe_set_float_format(struct hdspe* hdspe, bool val)
 	hdspe->m.set_float_format(hdspe, val);
 }
 
-static int snd_hdspe_hw_params(struct snd_pcm_substream *substream,
-			       struct snd_pcm_hw_params *params)
+/* Returns the pid of a process other than this_pid that has a PCM
+ * stream open on the card, main PCM device or port PCM device, or -1
+ * if there is none. Caller holds hdspe->lock. */
+static pid_t hdspe_other_pid(struct hdspe *hdspe, pid_t this_pid)
+{
+	int i, s;
+
+	if (hdspe->playback_pid > 0 && hdspe->playback_pid != this_pid)
+		return hdspe->playback_pid;
+	if (hdspe->capture_pid > 0 && hdspe->capture_pid != this_pid)
+		return hdspe->capture_pid;
+	for (i = 0; i < hdspe->port_count; i++) {
+		for (s = 0; s < 2; s++) {
+			pid_t pid = hdspe->ports[i].pid[s];
+			if (pid > 0 && pid != this_pid)
+				return pid;
+		}
+	}
+	return -1;
+}
+
+/* Check the hardware parameters against those in use by other processes,
+ * and set sample rate and period size. */
+static int hdspe_pcm_set_params(struct hdspe *hdspe,
+				struct snd_pcm_hw_params *params,
+				pid_t this_pid)
 {
-	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
-	int err;
-	int i;
-	pid_t this_pid;
 	pid_t other_pid;
+	u64 t;
+	int err;
 
-	spin_lock_irq(&hdspe->lock);
+	/* Held from the check against other processes until the rate and
+	 * period size are set, so two processes cannot both pass the check
+	 * and then set different parameters. Not hdspe->lock: a speed mode
+	 * change remaps the mixer, which can take thousands of register
+	 * writes and reschedules in between. */
+	mutex_lock(&hdspe->control_mutex);
 
-	if (substream->pstr->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		this_pid = hdspe->playback_pid;
-		other_pid = hdspe->capture_pid;
-	} else {
-		this_pid = hdspe->capture_pid;
-		other_pid = hdspe->playback_pid;
-	}
+	t = hdspe_irqs_off_begin();
+	spin_lock_irq(&hdspe->lock);
 
-	if (other_pid > 0 && this_pid != other_pid) {
+	other_pid = hdspe_other_pid(hdspe, this_pid);
+	if (other_pid > 0) {
 
-		/* The other stream is open, and not by the same
+		/* Another stream is open, and not by the same
 		   task as this one. Make sure that the parameters
 		   that matter are the same.
 		   */
@@ -315,41 +1040,44 @@ static int snd_hdspe_hw_params(struct snd_pcm_substream *substream,
 		u32 sysrate = hdspe_read_system_sample_rate(hdspe);		
 		if (params_rate(params) != sysrate) {
 			spin_unlock_irq(&hdspe->lock);
+			hdspe_irqs_off_end(hdspe, t, __func__);
 			dev_warn(hdspe->card->dev,
  "Requested sample rate %d does not match actual rate %d used by process %d.\n",
 				 params_rate(params), sysrate, other_pid);
 			_snd_pcm_hw_param_setempty(params,
 					SNDRV_PCM_HW_PARAM_RATE);
-			return -EBUSY;
+			err = -EBUSY;
+			goto unlock;
 		}
 
 		if (params_period_size(params) != hdspe->period_size) {
 			spin_unlock_irq(&hdspe->lock);
+			hdspe_irqs_off_end(hdspe, t, __func__);
 			dev_warn(hdspe->card->dev,
  "Requested period size %d does not match actual latency used by process %d.\n",
 				 params_period_size(params),
 				 hdspe->period_size);
 			_snd_pcm_hw_param_setempty(params,
 					SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
-			return -EBUSY;
+			err = -EBUSY;
+			goto unlock;
 		}
 
 	}
 	/* We're fine. */
 	spin_unlock_irq(&hdspe->lock);
+	hdspe_irqs_off_end(hdspe, t, __func__);
 
 	/* how to make sure that the rate matches an externally-set one ?   */
 
-	spin_lock_irq(&hdspe->lock);
 	err = hdspe_set_sample_rate(hdspe, params_rate(params));
 	if (err < 0) {
 		dev_info(hdspe->card->dev, "err on hdspe_set_rate: %d\n", err);
-		spin_unlock_irq(&hdspe->lock);
 		_snd_pcm_hw_param_setempty(params,
 				SNDRV_PCM_HW_PARAM_RATE);
-		return err;
+		goto unlock;
 	}
-	spin_unlock_irq(&hdspe->lock);
+	WRITE_ONCE(hdspe->irq_stats.rate, params_rate(params));
 
 	err = hdspe_set_interrupt_interval(hdspe,
 			params_period_size(params));
@@ -358,15 +1086,41 @@ static int snd_hdspe_hw_params(struct snd_pcm_substream *substream,
 			 "err on hdspe_set_interrupt_interval: %d\n", err);
 		_snd_pcm_hw_param_setempty(params,
 				SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
-		return err;
+		goto unlock;
 	}
 
+	err = 0;
+unlock:
+	mutex_unlock(&hdspe->control_mutex);
+	return err;
+}
+
+static int snd_hdspe_hw_params(struct snd_pcm_substream *substream,
+			       struct snd_pcm_hw_params *params)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	int stream = substream->stream;
+	bool playback = (stream == SNDRV_PCM_STREAM_PLAYBACK);
+	const signed char *map;
+	u64 mask = 0;
+	int err;
+	int i;
+
+	err = hdspe_pcm_set_params(hdspe, params,
+			playback ? hdspe->playback_pid : hdspe->capture_pid);
+	if (err < 0)
+		return err;
+
 	/* Memory allocation, takashi's method, dont know if we should
 	 * spinlock
 	 */
 	/* malloc all buffer even if not enabled to get sure */
 	/* Update for MADI rev 204: we need to allocate for all channels,
 	 * otherwise it doesn't work at 96kHz */
+	/* This picks up the buffer preallocated in
+	 * snd_hdspe_preallocate_memory(), which persists for the lifetime
+	 * of the card, so the DMA page tables stay valid across
+	 * hw_free()/hw_params() cycles. */
 
 	err =
 		snd_pcm_lib_malloc_pages(substream, HDSPE_DMA_AREA_BYTES);
@@ -376,36 +1130,35 @@ static int snd_hdspe_hw_params(struct snd_pcm_substream *substream,
 		return err;
 	}
 
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		/* Enable only the required DMA channels. */
-		for (i = 0; i < params_channels(params); ++i) {
-			int c = hdspe->channel_map_out[i];
-
-			if (c < 0)
-				continue;      /* just make sure */
-			hdspe_set_channel_dma_addr(hdspe, substream,
-						   HDSPE_pageAddressBufferOut,
-						   c);
-			snd_hdspe_enable_out(hdspe, c, 1);
-		}
+	/* Enable only the required DMA channels. */
+	map = playback ? hdspe->channel_map_out : hdspe->channel_map_in;
+	for (i = 0; i < params_channels(params); ++i) {
+		if (map[i] < 0)
+			continue;      /* just make sure */
+		mask |= 1ULL << map[i];
+	}
+
+	err = hdspe_claim_dma_channels(hdspe, stream,
+				       &hdspe->dma_channels[stream], mask);
+	if (err < 0) {
+		dev_warn(hdspe->card->dev,
+			 "Requested channels are in use by a port PCM device.\n");
+		snd_pcm_lib_free_pages(substream);
+		return err;
+	}
 
+	for (i = 0; i < HDSPE_MAX_CHANNELS; ++i) {
+		if (mask & (1ULL << i))
+			hdspe_enable_dma_channel(hdspe, substream, i, i);
+	}
+
+	if (playback) {
 		hdspe->playback_buffer =
 			(unsigned char *) substream->runtime->dma_area;
 		dev_dbg(hdspe->card->dev,
 			"Allocated sample buffer for playback at %p\n",
 				hdspe->playback_buffer);
 	} else {
-		for (i = 0; i < params_channels(params); ++i) {
-			int c = hdspe->channel_map_in[i];
-
-			if (c < 0)
-				continue;
-			hdspe_set_channel_dma_addr(hdspe, substream,
-						   HDSPE_pageAddressBufferIn,
-						   c);
-			snd_hdspe_enable_in(hdspe, c, 1);
-		}
-
 		hdspe->capture_buffer =
 			(unsigned char *) substream->runtime->dma_area;
 		dev_dbg(hdspe->card->dev,
@@ -429,6 +1182,8 @@ static int snd_hdspe_hw_params(struct snd_pcm_substream *substream,
 	   params_buffer_size(params));
 	   */
 
+	hdspe_pcm_xfer_setup(substream, params_channels(params));
+
 	/* Switch to native float format if requested, s32le otherwise. */
 	snd_hdspe_set_float_format(
 		hdspe, params_format(params) == SNDRV_PCM_FORMAT_FLOAT_LE);
@@ -438,22 +1193,18 @@ static int snd_hdspe_hw_params(struct snd_pcm_substream *substream,
 
 static int snd_hdspe_hw_free(struct snd_pcm_substream *substream)
 {
-	int i;
 	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	int stream = substream->stream;
 
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		/* Just disable all channels. The saving when disabling a */
-		/* smaller set is not worth the trouble. */
-		for (i = 0; i < HDSPE_MAX_CHANNELS; ++i)
-			snd_hdspe_enable_out(hdspe, i, 0);
+	/* Disable the channels we enabled. Port PCM devices may be
+	 * using others. */
+	hdspe_release_dma_channels(hdspe, stream,
+				   &hdspe->dma_channels[stream]);
 
+	if (stream == SNDRV_PCM_STREAM_PLAYBACK)
 		hdspe->playback_buffer = NULL;
-	} else {
-		for (i = 0; i < HDSPE_MAX_CHANNELS; ++i)
-			snd_hdspe_enable_in(hdspe, i, 0);
-
+	else
 		hdspe->capture_buffer = NULL;
-	}
 
 	snd_pcm_lib_free_pages(substream);
 
@@ -530,6 +1281,7 @@ static int snd_hdspe_ioctl(struct snd_pcm_substream *substream,
 static int snd_hdspe_trigger(struct snd_pcm_substream *substream, int cmd)
 {
 	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct hdspe_event ev = { .type = HDSPE_EVENT_RUNNING };
 	struct snd_pcm_substream *other;
 	int running;
 
@@ -557,9 +1309,11 @@ static int snd_hdspe_trigger(struct snd_pcm_substream *substream, int cmd)
 		snd_pcm_group_for_each_entry(s, substream) {
 			if (s == other) {
 				snd_pcm_trigger_done(s, substream);
-				if (cmd == SNDRV_PCM_TRIGGER_START)
+				if (cmd == SNDRV_PCM_TRIGGER_START) {
 					running |= 1 << s->stream;
-				else
+					hdspe->stream_start_pos[s->stream] =
+						hdspe_irq_frame_pos(hdspe);
+				} else
 					running &= ~(1 << s->stream);
 				goto _ok;
 			}
@@ -580,6 +1334,9 @@ static int snd_hdspe_trigger(struct snd_pcm_substream *substream, int cmd)
 	}
 _ok:
 	snd_pcm_trigger_done(substream, substream);
+	if (cmd == SNDRV_PCM_TRIGGER_START)
+		hdspe->stream_start_pos[substream->stream] =
+			hdspe_irq_frame_pos(hdspe);
 	if (!hdspe->running && running)
 		hdspe_start_audio(hdspe);
 	else if (hdspe->running && !running)
@@ -589,6 +1346,8 @@ _ok:
 
 	snd_ctl_notify(hdspe->card, SNDRV_CTL_EVENT_MASK_VALUE,
 		       hdspe->cid.running);
+	ev.running.running = running;
+	hdspe_post_event(hdspe, &ev);
 	
 	return 0;
 }
@@ -602,8 +1361,14 @@ static const struct snd_pcm_hardware snd_hdspe_playback_subinfo = {
 	.info = (SNDRV_PCM_INFO_MMAP |
 		 SNDRV_PCM_INFO_MMAP_VALID |
 		 SNDRV_PCM_INFO_NONINTERLEAVED |
-		 SNDRV_PCM_INFO_SYNC_START | SNDRV_PCM_INFO_DOUBLE),
-	.formats = SNDRV_PCM_FMTBIT_S32_LE,
+		 SNDRV_PCM_INFO_INTERLEAVED |
+		 SNDRV_PCM_INFO_SYNC_START | SNDRV_PCM_INFO_DOUBLE |
+		 SNDRV_PCM_INFO_NO_PERIOD_WAKEUP |
+		 SNDRV_PCM_INFO_HAS_LINK_ATIME |
+		 SNDRV_PCM_INFO_HAS_LINK_ABSOLUTE_ATIME),
+	.formats = (SNDRV_PCM_FMTBIT_S32_LE |
+		    SNDRV_PCM_FMTBIT_S16_LE |
+		    SNDRV_PCM_FMTBIT_S24_3LE),
 //	.formats = SNDRV_PCM_FMTBIT_FLOAT_LE,	
 	.rates = (SNDRV_PCM_RATE_32000 |
 		  SNDRV_PCM_RATE_44100 |
@@ -628,8 +1393,14 @@ static const struct snd_pcm_hardware snd_hdspe_capture_subinfo = {
 	.info = (SNDRV_PCM_INFO_MMAP |
 		 SNDRV_PCM_INFO_MMAP_VALID |
 		 SNDRV_PCM_INFO_NONINTERLEAVED |
-		 SNDRV_PCM_INFO_SYNC_START),
-	.formats = SNDRV_PCM_FMTBIT_S32_LE,
+		 SNDRV_PCM_INFO_INTERLEAVED |
+		 SNDRV_PCM_INFO_SYNC_START |
+		 SNDRV_PCM_INFO_NO_PERIOD_WAKEUP |
+		 SNDRV_PCM_INFO_HAS_LINK_ATIME |
+		 SNDRV_PCM_INFO_HAS_LINK_ABSOLUTE_ATIME),
+	.formats = (SNDRV_PCM_FMTBIT_S32_LE |
+		    SNDRV_PCM_FMTBIT_S16_LE |
+		    SNDRV_PCM_FMTBIT_S24_3LE),
 //	.formats = SNDRV_PCM_FMTBIT_FLOAT_LE,
 	.rates = (SNDRV_PCM_RATE_32000 |
 		  SNDRV_PCM_RATE_44100 |
@@ -829,36 +1600,27 @@ hdspe_hw_constraints_aes_sample_rates = {
 	.mask = 0
 };
 
-static int snd_hdspe_open(struct snd_pcm_substream *substream)
+/* Period and buffer size constraints common to the main PCM device
+ * and the port PCM devices */
+static void hdspe_pcm_add_constraints(struct hdspe *hdspe,
+				      struct snd_pcm_runtime *runtime)
 {
-	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
-	struct snd_pcm_runtime *runtime = substream->runtime;
-	bool playback = (substream->stream == SNDRV_PCM_STREAM_PLAYBACK);
-
-	spin_lock_irq(&hdspe->lock);
-	snd_pcm_set_sync(substream);
-	runtime->hw = (playback) ? snd_hdspe_playback_subinfo :
-		snd_hdspe_capture_subinfo;
-
-	if (playback) {
-		if (!hdspe->capture_substream)
-			hdspe_stop_audio(hdspe);
-
-		hdspe->playback_pid = current->pid;
-		hdspe->playback_substream = substream;
-	} else {
-		if (!hdspe->playback_substream)
-			hdspe_stop_audio(hdspe);
-
-		hdspe->capture_pid = current->pid;
-		hdspe->capture_substream = substream;
-	}
-
-	spin_unlock_irq(&hdspe->lock);
-
 	snd_pcm_hw_constraint_msbits(runtime, 0, 32, 24);
 	snd_pcm_hw_constraint_pow2(runtime, 0, SNDRV_PCM_HW_PARAM_PERIOD_SIZE);
 
+	/* The DMA buffers are never interleaved. Non-native formats are
+	 * converted by the copy callbacks. */
+	snd_pcm_hw_constraint_mask(runtime, SNDRV_PCM_HW_PARAM_ACCESS,
+		(1U << (__force int)SNDRV_PCM_ACCESS_MMAP_NONINTERLEAVED) |
+		(1U << (__force int)SNDRV_PCM_ACCESS_RW_INTERLEAVED) |
+		(1U << (__force int)SNDRV_PCM_ACCESS_RW_NONINTERLEAVED));
+	snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_FORMAT,
+			    snd_hdspe_hw_rule_format_access, NULL,
+			    SNDRV_PCM_HW_PARAM_ACCESS, -1);
+	snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_ACCESS,
+			    snd_hdspe_hw_rule_access_format, NULL,
+			    SNDRV_PCM_HW_PARAM_FORMAT, -1);
+
 	switch (hdspe->io_type) {
 	case HDSPE_AIO:		
 	case HDSPE_RAYDAT:
@@ -885,7 +1647,44 @@ static int snd_hdspe_open(struct snd_pcm_substream *substream)
 		runtime->hw.rates |= SNDRV_PCM_RATE_KNOT;
 		snd_pcm_hw_constraint_list(runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
 				&hdspe_hw_constraints_aes_sample_rates);
+	}
+}
+
+static int snd_hdspe_open(struct snd_pcm_substream *substream)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	bool playback = (substream->stream == SNDRV_PCM_STREAM_PLAYBACK);
+	int err;
+
+	err = hdspe_pcm_xfer_alloc(runtime);
+	if (err < 0)
+		return err;
+
+	spin_lock_irq(&hdspe->lock);
+	snd_pcm_set_sync(substream);
+	runtime->hw = (playback) ? snd_hdspe_playback_subinfo :
+		snd_hdspe_capture_subinfo;
+
+	if (playback) {
+		if (!hdspe->capture_substream)
+			hdspe_stop_audio(hdspe);
+
+		WRITE_ONCE(hdspe->playback_pid, current->pid);
+		hdspe->playback_substream = substream;
 	} else {
+		if (!hdspe->playback_substream)
+			hdspe_stop_audio(hdspe);
+
+		WRITE_ONCE(hdspe->capture_pid, current->pid);
+		hdspe->capture_substream = substream;
+	}
+
+	spin_unlock_irq(&hdspe->lock);
+
+	hdspe_pcm_add_constraints(hdspe, runtime);
+
+	if (HDSPE_AES != hdspe->io_type) {
 		snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
 				(playback ?
 				 snd_hdspe_hw_rule_rate_out_channels :
@@ -914,10 +1713,10 @@ static int snd_hdspe_release(struct snd_pcm_substream *substream)
 	spin_lock_irq(&hdspe->lock);
 
 	if (playback) {
-		hdspe->playback_pid = -1;
+		WRITE_ONCE(hdspe->playback_pid, -1);
 		hdspe->playback_substream = NULL;
 	} else {
-		hdspe->capture_pid = -1;
+		WRITE_ONCE(hdspe->capture_pid, -1);
 		hdspe->capture_substream = NULL;
 	}
 
@@ -935,14 +1734,503 @@ static const struct snd_pcm_ops snd_hdspe_ops = {
 	.prepare = snd_hdspe_prepare,
 	.trigger = snd_hdspe_trigger,
 	.pointer = snd_hdspe_hw_pointer,
-	/* TODO: .get_time_info = snd_hdspe_get_time_info */
+	.get_time_info = snd_hdspe_get_time_info,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+	.copy = snd_hdspe_copy,
+#else
+	.copy_user = snd_hdspe_copy_user,
+	.copy_kernel = snd_hdspe_copy_kernel,
+#endif
+	.fill_silence = snd_hdspe_fill_silence,
 };
 
+/*------------------------------------------------------------
+   port PCM devices
+ ------------------------------------------------------------*/
+
+/* Port PCM devices expose the logical channels of a single port, e.g.
+ * ADAT1, AES or MADI 17-32, as a separate PCM device with its own DMA
+ * buffer, mapped directly onto the DMA channels of those logical channels.
+ * Different processes can use different ports simultaneously, as long as
+ * they agree on sample rate and period size, like for the main PCM device.
+ * DMA channels used by one PCM device can not be used by another one at
+ * the same time. */
+
+static void hdspe_port_tables(struct hdspe *hdspe, int stream,
+			      enum hdspe_speed speed,
+			      const char * const **names, int *count)
+{
+	bool playback = (stream == SNDRV_PCM_STREAM_PLAYBACK);
+
+	switch (speed) {
+	case HDSPE_SPEED_SINGLE:
+		*names = playback ? hdspe->t.port_names_out_ss
+			: hdspe->t.port_names_in_ss;
+		*count = playback ? hdspe->t.ss_out_channels
+			: hdspe->t.ss_in_channels;
+		break;
+	case HDSPE_SPEED_DOUBLE:
+		*names = playback ? hdspe->t.port_names_out_ds
+			: hdspe->t.port_names_in_ds;
+		*count = playback ? hdspe->t.ds_out_channels
+			: hdspe->t.ds_in_channels;
+		break;
+	default:
+		*names = playback ? hdspe->t.port_names_out_qs
+			: hdspe->t.port_names_in_qs;
+		*count = playback ? hdspe->t.qs_out_channels
+			: hdspe->t.qs_in_channels;
+	}
+}
+
+/* Length of the port name prefix of a channel name, e.g. "ADAT1"
+ * in "ADAT1.3" */
+static int hdspe_port_prefix_len(const char *name)
+{
+	const char *dot = strchr(name, '.');
+	return dot ? dot - name : strlen(name);
+}
+
+/* Find the port for the chunk'th group of at most HDSPE_PORT_MAX_CHANNELS
+ * channels with given name prefix, or NULL if there is no such port. */
+static struct hdspe_port *hdspe_lookup_port(struct hdspe *hdspe,
+					    const char *prefix, int len,
+					    int chunk)
+{
+	struct hdspe_port *port;
+	int i;
+
+	for (i = 0; i < hdspe->port_count; i++) {
+		port = &hdspe->ports[i];
+		if (port->chunk == chunk && strlen(port->prefix) == len &&
+		    strncmp(port->prefix, prefix, len) == 0)
+			return port;
+	}
+	return NULL;
+}
+
+/* Same, but add the port if not found. */
+static struct hdspe_port *hdspe_find_port(struct hdspe *hdspe,
+					  const char *prefix, int len,
+					  int chunk)
+{
+	struct hdspe_port *port = hdspe_lookup_port(hdspe, prefix, len, chunk);
+	if (port)
+		return port;
+
+	if (hdspe->port_count >= HDSPE_MAX_PORTS ||
+	    len >= sizeof(port->prefix))
+		return NULL;
+
+	port = &hdspe->ports[hdspe->port_count++];
+	memset(port, 0, sizeof(*port));
+	strncpy(port->prefix, prefix, len);
+	port->chunk = chunk;
+	port->pid[0] = port->pid[1] = -1;
+	return port;
+}
+
+/* Group the logical channels of each speed mode and direction into ports,
+ * according to the port names in the card model tables. */
+static void hdspe_init_ports(struct hdspe *hdspe)
+{
+	const char * const *names;
+	int stream, speed, n, l, k;
+
+	hdspe->port_count = 0;
+	for (stream = 0; stream < 2; stream++) {
+		for (speed = 0; speed < HDSPE_SPEED_COUNT; speed++) {
+			hdspe_port_tables(hdspe, stream, speed, &names, &n);
+			for (l = 0, k = 0; l < n; l++, k++) {
+				struct hdspe_port *port;
+				int len = hdspe_port_prefix_len(names[l]);
+
+				/* k: index of the channel in its port */
+				if (l > 0 &&
+				    (hdspe_port_prefix_len(names[l-1]) != len ||
+				     strncmp(names[l-1], names[l], len) != 0))
+					k = 0;
+
+				port = hdspe_find_port(
+					hdspe, names[l], len,
+					k / HDSPE_PORT_MAX_CHANNELS);
+				if (!port)
+					continue;
+				if (port->count[stream][speed] == 0)
+					port->first[stream][speed] = l;
+				port->count[stream][speed]++;
+			}
+		}
+	}
+}
+
+/* Maximum number of channels of the port in the given direction. */
+static int hdspe_port_max_channels(struct hdspe_port *port, int stream)
+{
+	int speed, n = 0;
+	for (speed = 0; speed < HDSPE_SPEED_COUNT; speed++)
+		n = max(n, (int)port->count[stream][speed]);
+	return n;
+}
+
+static int snd_hdspe_port_hw_params(struct snd_pcm_substream *substream,
+				    struct snd_pcm_hw_params *params)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct hdspe_port *port = hdspe_substream_port(substream);
+	int stream = substream->stream;
+	bool playback = (stream == SNDRV_PCM_STREAM_PLAYBACK);
+	const signed char *map;
+	enum hdspe_speed speed;
+	int first, n;
+	u64 mask = 0;
+	int err;
+	int i;
+
+	err = hdspe_pcm_set_params(hdspe, params, port->pid[stream]);
+	if (err < 0)
+		return err;
+
+	speed = hdspe_speed_mode(hdspe);
+	first = port->first[stream][speed];
+	n = port->count[stream][speed];
+	if (params_channels(params) != n) {
+		dev_warn(hdspe->card->dev,
+			 "Port %s has %d channels at this sample rate.\n",
+			 port->pcm->name, n);
+		return -EINVAL;
+	}
+
+	/* The port DMA buffer is allocated on first use, and kept
+	 * until the card is freed, see snd_hdspe_port_free(). */
+	if (!port->buffer[stream].area) {
+		err = snd_dma_alloc_pages(SNDRV_DMA_TYPE_DEV_SG,
+				&hdspe->pci->dev,
+				hdspe_port_max_channels(port, stream)
+				* HDSPE_CHANNEL_BUFFER_BYTES,
+				&port->buffer[stream]);
+		if (err < 0) {
+			dev_info(hdspe->card->dev,
+				 "err on snd_dma_alloc_pages: %d\n", err);
+			return err;
+		}
+	}
+	snd_pcm_set_runtime_buffer(substream, &port->buffer[stream]);
+	substream->runtime->dma_bytes = n * HDSPE_CHANNEL_BUFFER_BYTES;
+
+	map = playback ? hdspe->channel_map_out : hdspe->channel_map_in;
+	for (i = 0; i < n; i++) {
+		if (map[first + i] >= 0)
+			mask |= 1ULL << map[first + i];
+	}
+
+	err = hdspe_claim_dma_channels(hdspe, stream,
+				       &port->dma_channels[stream], mask);
+	if (err < 0) {
+		dev_warn(hdspe->card->dev,
+			 "Channels of port %s are in use by another PCM device.\n",
+			 port->pcm->name);
+		snd_pcm_set_runtime_buffer(substream, NULL);
+		return err;
+	}
+
+	/* Logical channel first+i uses slot i in our DMA buffer */
+	for (i = 0; i < n; i++) {
+		if (map[first + i] >= 0)
+			hdspe_enable_dma_channel(hdspe, substream,
+						 map[first + i], i);
+	}
+
+	hdspe_pcm_xfer_setup(substream, n);
+
+	snd_hdspe_set_float_format(
+		hdspe, params_format(params) == SNDRV_PCM_FORMAT_FLOAT_LE);
+
+	return 0;
+}
+
+static int snd_hdspe_port_hw_free(struct snd_pcm_substream *substream)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct hdspe_port *port = hdspe_substream_port(substream);
+
+	hdspe_release_dma_channels(hdspe, substream->stream,
+				   &port->dma_channels[substream->stream]);
+
+	snd_pcm_set_runtime_buffer(substream, NULL);
+
+	return 0;
+}
+
+static int snd_hdspe_port_channel_info(struct snd_pcm_substream *substream,
+				       struct snd_pcm_channel_info *info)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+
+	if (snd_BUG_ON(info->channel >= runtime->channels))
+		return -EINVAL;
+
+	info->offset = info->channel * HDSPE_CHANNEL_BUFFER_BYTES;
+	info->first = 0;
+	info->step = 32;
+	return 0;
+}
+
+static int snd_hdspe_port_ioctl(struct snd_pcm_substream *substream,
+				unsigned int cmd, void *arg)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+
+	switch (cmd) {
+	case SNDRV_PCM_IOCTL1_RESET:
+		/* The DMA engine is always running */
+		substream->runtime->status->hw_ptr = hdspe_hw_pointer(hdspe);
+		return 0;
+
+	case SNDRV_PCM_IOCTL1_CHANNEL_INFO:
+		return snd_hdspe_port_channel_info(substream, arg);
+
+	default:
+		break;
+	}
+
+	return snd_pcm_lib_ioctl(substream, cmd, arg);
+}
+
+static int snd_hdspe_port_trigger(struct snd_pcm_substream *substream,
+				  int cmd)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct hdspe_port *port = hdspe_substream_port(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int stream = substream->stream;
+
+	spin_lock(&hdspe->lock);
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		port->running |= 1 << stream;
+		port->stream_start_pos[stream] = hdspe_irq_frame_pos(hdspe);
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+		port->running &= ~(1 << stream);
+		/* The DMA engine keeps cycling through the buffer
+		 * until hw_free(). */
+		if (stream == SNDRV_PCM_STREAM_PLAYBACK)
+			memset(runtime->dma_area, 0, runtime->dma_bytes);
+		break;
+	default:
+		snd_BUG();
+		spin_unlock(&hdspe->lock);
+		return -EINVAL;
+	}
+	spin_unlock(&hdspe->lock);
+
+	return 0;
+}
+
+static int snd_hdspe_port_hw_rule_channels_rate(
+	struct snd_pcm_hw_params *params, struct snd_pcm_hw_rule *rule)
+{
+	struct snd_pcm_substream *substream = rule->private;
+	struct hdspe_port *port = hdspe_substream_port(substream);
+	unsigned char *count = port->count[substream->stream];
+	struct snd_interval *c =
+	    hw_param_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS);
+	struct snd_interval *r =
+	    hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE);
+	unsigned int list[HDSPE_SPEED_COUNT];
+	int n = 0;
+
+	if (r->min < 64000)
+		list[n++] = count[HDSPE_SPEED_SINGLE];
+	if (r->max >= 64000 && r->min <= 96000)
+		list[n++] = count[HDSPE_SPEED_DOUBLE];
+	if (r->max > 96000)
+		list[n++] = count[HDSPE_SPEED_QUAD];
+
+	return snd_interval_list(c, n, list, 0);
+}
+
+static int snd_hdspe_port_hw_rule_rate_channels(
+	struct snd_pcm_hw_params *params, struct snd_pcm_hw_rule *rule)
+{
+	static const unsigned int rate_min[HDSPE_SPEED_COUNT] = {
+		32000, 64000, 128000 };
+	static const unsigned int rate_max[HDSPE_SPEED_COUNT] = {
+		48000, 96000, 192000 };
+	struct snd_pcm_substream *substream = rule->private;
+	struct hdspe_port *port = hdspe_substream_port(substream);
+	unsigned char *count = port->count[substream->stream];
+	struct snd_interval *c =
+	    hw_param_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS);
+	struct snd_interval *r =
+	    hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE);
+	struct snd_interval t = {
+		.min = UINT_MAX,
+		.max = 0,
+		.integer = 1,
+	};
+	int speed;
+
+	for (speed = 0; speed < HDSPE_SPEED_COUNT; speed++) {
+		if (count[speed] == 0 || !snd_interval_test(c, count[speed]))
+			continue;
+		t.min = min(t.min, rate_min[speed]);
+		t.max = max(t.max, rate_max[speed]);
+	}
+
+	return snd_interval_refine(r, &t);
+}
+
+static int snd_hdspe_port_open(struct snd_pcm_substream *substream)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct hdspe_port *port = hdspe_substream_port(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int stream = substream->stream;
+	bool playback = (stream == SNDRV_PCM_STREAM_PLAYBACK);
+	int n = hdspe_port_max_channels(port, stream);
+	int err;
+
+	err = hdspe_pcm_xfer_alloc(runtime);
+	if (err < 0)
+		return err;
+
+	runtime->hw = (playback) ? snd_hdspe_playback_subinfo :
+		snd_hdspe_capture_subinfo;
+	runtime->hw.info &= ~(SNDRV_PCM_INFO_SYNC_START |
+			      SNDRV_PCM_INFO_DOUBLE);
+	runtime->hw.channels_max = n;
+	runtime->hw.buffer_bytes_max = n * HDSPE_CHANNEL_BUFFER_BYTES;
+	runtime->hw.period_bytes_max = (8192 * 4) * n;
+
+	spin_lock_irq(&hdspe->lock);
+	port->pid[stream] = current->pid;
+	port->substream[stream] = substream;
+	spin_unlock_irq(&hdspe->lock);
+
+	hdspe_pcm_add_constraints(hdspe, runtime);
+
+	snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_CHANNELS,
+			    snd_hdspe_port_hw_rule_channels_rate, substream,
+			    SNDRV_PCM_HW_PARAM_RATE, -1);
+
+	if (HDSPE_AES != hdspe->io_type)
+		snd_pcm_hw_rule_add(runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
+				    snd_hdspe_port_hw_rule_rate_channels,
+				    substream,
+				    SNDRV_PCM_HW_PARAM_CHANNELS, -1);
+
+	return 0;
+}
+
+static int snd_hdspe_port_release(struct snd_pcm_substream *substream)
+{
+	struct hdspe *hdspe = snd_pcm_substream_chip(substream);
+	struct hdspe_port *port = hdspe_substream_port(substream);
+
+	spin_lock_irq(&hdspe->lock);
+	port->pid[substream->stream] = -1;
+	port->substream[substream->stream] = NULL;
+	spin_unlock_irq(&hdspe->lock);
+
+	return 0;
+}
+
+static const struct snd_pcm_ops snd_hdspe_port_ops = {
+	.open = snd_hdspe_port_open,
+	.close = snd_hdspe_port_release,
+	.ioctl = snd_hdspe_port_ioctl,
+	.hw_params = snd_hdspe_port_hw_params,
+	.hw_free = snd_hdspe_port_hw_free,
+	.prepare = snd_hdspe_prepare,
+	.trigger = snd_hdspe_port_trigger,
+	.pointer = snd_hdspe_hw_pointer,
+	.get_time_info = snd_hdspe_get_time_info,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+	.copy = snd_hdspe_copy,
+#else
+	.copy_user = snd_hdspe_copy_user,
+	.copy_kernel = snd_hdspe_copy_kernel,
+#endif
+	.fill_silence = snd_hdspe_fill_silence,
+};
+
+static void snd_hdspe_port_free(struct snd_pcm *pcm)
+{
+	struct hdspe *hdspe = pcm->private_data;
+	struct hdspe_port *port = &hdspe->ports[pcm->device - 1];
+	int s;
+
+	for (s = 0; s < 2; s++) {
+		if (port->buffer[s].area)
+			snd_dma_free_pages(&port->buffer[s]);
+		port->buffer[s].area = NULL;
+	}
+}
+
+/* Create a PCM device for each port, numbered from 1 on. */
+static int snd_hdspe_create_ports(struct snd_card *card,
+				  struct hdspe *hdspe)
+{
+	int i, err;
+
+	hdspe_init_ports(hdspe);
+
+	for (i = 0; i < hdspe->port_count; i++) {
+		struct hdspe_port *port = &hdspe->ports[i];
+		int nout = hdspe_port_max_channels(
+			port, SNDRV_PCM_STREAM_PLAYBACK);
+		int nin = hdspe_port_max_channels(
+			port, SNDRV_PCM_STREAM_CAPTURE);
+		struct snd_pcm *pcm;
+		char name[64];
+
+		/* split ports are named after their channel range */
+		if (port->chunk > 0 ||
+		    hdspe_lookup_port(hdspe, port->prefix,
+				      strlen(port->prefix), 1) != NULL)
+			snprintf(name, sizeof(name), "%s %s %d-%d",
+				 hdspe->card_name, port->prefix,
+				 port->chunk * HDSPE_PORT_MAX_CHANNELS + 1,
+				 port->chunk * HDSPE_PORT_MAX_CHANNELS +
+				 max(nin, nout));
+		else
+			snprintf(name, sizeof(name), "%s %s",
+				 hdspe->card_name, port->prefix);
+
+		err = snd_pcm_new(card, name, i + 1,
+				  nout > 0 ? 1 : 0, nin > 0 ? 1 : 0, &pcm);
+		if (err < 0)
+			return err;
+
+		port->pcm = pcm;
+		pcm->private_data = hdspe;
+		strscpy(pcm->name, name, sizeof(pcm->name));
+
+		if (nout > 0)
+			snd_pcm_set_ops(pcm, SNDRV_PCM_STREAM_PLAYBACK,
+					&snd_hdspe_port_ops);
+		if (nin > 0)
+			snd_pcm_set_ops(pcm, SNDRV_PCM_STREAM_CAPTURE,
+					&snd_hdspe_port_ops);
+
+		pcm->info_flags = SNDRV_PCM_INFO_JOINT_DUPLEX;
+		pcm->private_free = snd_hdspe_port_free;
+
+		dev_dbg(hdspe->card->dev,
+			"Created port PCM device %d '%s', %d in, %d out.\n",
+			i + 1, name, nin, nout);
+	}
+
+	return 0;
+}
+
 int snd_hdspe_create_pcm(struct snd_card *card,
 			 struct hdspe *hdspe)
 {
 	struct snd_pcm *pcm;
-	int err;
+	int err, i;
 
 	hdspe->playback_pid = -1;
 	hdspe->capture_pid = -1;
@@ -970,6 +2258,13 @@ int snd_hdspe_create_pcm(struct snd_card *card,
 
 	hdspe_set_period_size(hdspe);
 
-	return 0;
+	/* Start with all DMA channels disabled, in sync with the
+	 * DMA channel register cache. */
+	for (i = 0; i < HDSPE_MAX_CHANNELS; i++) {
+		snd_hdspe_enable_out(hdspe, i, 0);
+		snd_hdspe_enable_in(hdspe, i, 0);
+	}
+
+	return snd_hdspe_create_ports(card, hdspe);
 }
 
@@ -58,7 +58,7 @@ void hdspe_proc_read_common(struct snd_info_buffer *buffer,
 			    struct hdspe_status* s)
 {
 	int i;
-	hdspe->m.read_status(hdspe, s);
+	hdspe_get_status(hdspe, s);
 
 	snd_iprintf(buffer, "RME HDSPe %s serial %08d firmware %d\n\n",
 		    HDSPE_IO_TYPE_NAME(hdspe->io_type),
@@ -120,6 +120,17 @@ void hdspe_proc_read_common2(struct snd_info_buffer *buffer,
 	snd_iprintf(buffer, "Running     \t: %d\n", hdspe->running);
 	snd_iprintf(buffer, "Capture PID \t: %d\n", hdspe->capture_pid);
 	snd_iprintf(buffer, "Playback PID\t: %d\n", hdspe->playback_pid);
+
+	snd_iprintf(buffer, "\n");
+	for (i = 0; i < 2; i++) {
+		struct hdspe_xruns *x = &hdspe->xruns;
+		const char *dir = i == SNDRV_PCM_STREAM_PLAYBACK ?
+			"Playback" : "Capture ";
+		snd_iprintf(buffer, "%s missed periods\t: %u (last at %lld ns)\n",
+			    dir, x->missed[i], ktime_to_ns(x->missed_time[i]));
+		snd_iprintf(buffer, "%s late interrupts\t: %u (last at %lld ns)\n",
+			    dir, x->late[i], ktime_to_ns(x->late_time[i]));
+	}
 	
 	snd_iprintf(buffer, "\n");
 	snd_iprintf(buffer, "Capture channel mapping:\n");
@@ -193,5 +204,9 @@ void snd_hdspe_proc_init(struct hdspe *hdspe)
 	/* debug file to read all hdspe registers */
 	snd_card_ro_proc_new(hdspe->card, "debug", hdspe,
 			     snd_hdspe_proc_read_debug);
+
+	/* interleaved format conversion benchmark */
+	snd_card_ro_proc_new(hdspe->card, "copy_benchmark", hdspe,
+			     hdspe_pcm_proc_copy_benchmark);
 #endif
 }
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/**
+ * hdspe_schedule.c
+ * @brief RME HDSPe driver timed command queue.
+ *
+ * Clients schedule matrix mixer and DDS changes at a frame counter value.
+ * The interrupt thread carries out the commands due in the coming period
+ * right after updating the frame counter, so changes line up with
+ * program boundaries to within one period, without a real-time thread
+ * in user space.
+ */
+
+#include "hdspe.h"
+#include "hdspe_core.h"
+
+#include <linux/slab.h>
+
+/* Number of commands taken off the queue per queue lock. */
+#define HDSPE_SCHEDULE_BATCH 16
+
+/* i-th pending command, counting from the head of the ring. */
+#define HDSPE_SCHEDULE_CMD(s, i) \
+	((s)->cmd[((s)->head + (i)) % HDSPE_SCHEDULE_SIZE])
+
+static int hdspe_check_command(struct hdspe *hdspe,
+			       const struct hdspe_command *c)
+{
+	u32 ddsmin, ddsmax;
+
+	switch (c->type) {
+	case HDSPE_COMMAND_MIXER:
+		if (c->mixer.destination >= HDSPE_MIXER_CHANNELS ||
+		    c->mixer.source >= 2 * HDSPE_MIXER_CHANNELS ||
+		    c->mixer.gain > 0xFFFF)
+			return -EINVAL;
+		return 0;
+
+	case HDSPE_COMMAND_DDS:
+		/* The range depends on the speed mode, which may change
+		 * before the command is due. Checked again then. */
+		hdspe_dds_range(hdspe, &ddsmin, &ddsmax);
+		if (c->dds.value < ddsmin || c->dds.value > ddsmax)
+			return -EINVAL;
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Stable insertion sort by frame. Requests are usually in order
+ * already, which makes this a single pass. */
+static void hdspe_sort_commands(struct hdspe_command *cmds, u32 count)
+{
+	struct hdspe_command c;
+	u32 i, j;
+
+	for (i = 1; i < count; i++) {
+		if (cmds[i - 1].frame <= cmds[i].frame)
+			continue;
+		c = cmds[i];
+		for (j = i; j > 0 && cmds[j - 1].frame > c.frame; j--)
+			cmds[j] = cmds[j - 1];
+		cmds[j] = c;
+	}
+}
+
+int hdspe_schedule_commands(struct hdspe *hdspe,
+			    const struct hdspe_commands *req)
+{
+	struct hdspe_schedule *s = &hdspe->schedule;
+	struct hdspe_command *cmds;
+	int err = 0;
+	int i, j, k;
+
+	if (req->count == 0)
+		return 0;
+	if (req->count > HDSPE_SCHEDULE_SIZE)
+		return -ENOSPC;
+
+	if (!snd_hdspe_use_is_exclusive(hdspe))
+		return -EBUSY;
+
+	cmds = vmemdup_user(u64_to_user_ptr(req->commands),
+			    req->count * sizeof(*cmds));
+	if (IS_ERR(cmds))
+		return PTR_ERR(cmds);
+
+	for (i = 0; i < req->count; i++) {
+		err = hdspe_check_command(hdspe, &cmds[i]);
+		if (err < 0)
+			goto out;
+	}
+	hdspe_sort_commands(cmds, req->count);
+
+	spin_lock(&s->lock);
+	if (s->count + req->count > HDSPE_SCHEDULE_SIZE) {
+		spin_unlock(&s->lock);
+		err = -ENOSPC;
+		goto out;
+	}
+
+	/* Merge from the back, so only pending commands due later than
+	 * the first new one move. New commands go after pending commands
+	 * due at the same frame. */
+	i = s->count - 1;
+	j = req->count - 1;
+	for (k = s->count + req->count - 1; j >= 0; k--) {
+		if (i >= 0 && HDSPE_SCHEDULE_CMD(s, i).frame > cmds[j].frame) {
+			HDSPE_SCHEDULE_CMD(s, k) = HDSPE_SCHEDULE_CMD(s, i);
+			i--;
+		} else {
+			HDSPE_SCHEDULE_CMD(s, k) = cmds[j];
+			j--;
+		}
+	}
+	s->count += req->count;
+	spin_unlock(&s->lock);
+
+	dev_dbg(hdspe->card->dev, "%s: %u commands scheduled.\n",
+		__func__, req->count);
+
+out:
+	kvfree(cmds);
+	return err;
+}
+
+void hdspe_cancel_schedule(struct hdspe *hdspe)
+{
+	struct hdspe_schedule *s = &hdspe->schedule;
+
+	spin_lock(&s->lock);
+	s->count = 0;
+	spin_unlock(&s->lock);
+}
+
+void hdspe_schedule_period(struct hdspe *hdspe)
+{
+	struct hdspe_schedule *s = &hdspe->schedule;
+	struct hdspe_command batch[HDSPE_SCHEDULE_BATCH];
+	bool changed_pb[HDSPE_MAX_CHANNELS] = { false };
+	u64 due = hdspe->frame_count + hdspe->period_size;
+	bool mixer_changed = false, dds_changed = false;
+	int i, n;
+
+	if (READ_ONCE(s->count) == 0)
+		return;
+
+	/* Commands are carried out without holding the queue lock. */
+	do {
+		spin_lock(&s->lock);
+		for (n = 0; n < HDSPE_SCHEDULE_BATCH && n < s->count &&
+			     HDSPE_SCHEDULE_CMD(s, n).frame < due; n++)
+			batch[n] = HDSPE_SCHEDULE_CMD(s, n);
+		s->head = (s->head + n) % HDSPE_SCHEDULE_SIZE;
+		s->count -= n;
+		spin_unlock(&s->lock);
+
+		for (i = 0; i < n; i++) {
+			const struct hdspe_command *c = &batch[i];
+
+			switch (c->type) {
+			case HDSPE_COMMAND_MIXER:
+				if (hdspe_set_mixer_gain(hdspe,
+							 c->mixer.destination,
+							 c->mixer.source,
+							 c->mixer.gain,
+							 changed_pb) > 0)
+					mixer_changed = true;
+				break;
+
+			case HDSPE_COMMAND_DDS:
+				/* Takes only the pll_lock leaf lock: this
+				 * thread must never wait for control_mutex,
+				 * held across mixer remaps. */
+				if (hdspe_write_dds(hdspe, c->dds.value) > 0)
+					dds_changed = true;
+				break;
+			}
+		}
+	} while (n == HDSPE_SCHEDULE_BATCH);
+
+	if (mixer_changed)
+		hdspe_notify_mixer(hdspe, changed_pb);
+	if (dds_changed)
+		HDSPE_CTL_NOTIFY(dds);
+}
+
+int hdspe_init_schedule(struct hdspe *hdspe)
+{
+	struct hdspe_schedule *s = &hdspe->schedule;
+
+	spin_lock_init(&s->lock);
+	s->head = 0;
+	s->count = 0;
+	s->cmd = kcalloc(HDSPE_SCHEDULE_SIZE, sizeof(*s->cmd), GFP_KERNEL);
+	return s->cmd ? 0 : -ENOMEM;
+}
+
+void hdspe_terminate_schedule(struct hdspe *hdspe)
+{
+	kfree(hdspe->schedule.cmd);
+	hdspe->schedule.cmd = NULL;
+}
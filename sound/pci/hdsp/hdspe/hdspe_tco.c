@@ -746,6 +746,7 @@ void hdspe_tco_mtc(struct hdspe* hdspe, const u8* buf, int count)
 void hdspe_tco_period_elapsed(struct hdspe* hdspe)
 {
 	struct hdspe_tco* c = hdspe->tco;
+	struct hdspe_event ev = { .type = HDSPE_EVENT_LTC };
 
 	spin_lock(&hdspe->tco->lock);
 	/* clock by which LTC frame start is measured. */
@@ -765,6 +766,9 @@ void hdspe_tco_period_elapsed(struct hdspe* hdspe)
 
 		c->ltc_in = ltc.tc;
 		c->ltc_in_frame_count = ltc.fc;
+		ev.ltc.ltc = c->ltc_in;
+		ev.ltc.frame_count = c->ltc_in_frame_count;
+		hdspe_post_event(hdspe, &ev);
 		//		if (hdspe->period_size >= 2048)
 		//		  c->ltc_in_frame_count -= hdspe->period_size / 2;
 		
@@ -1389,12 +1393,21 @@ if (n.prop != o.prop) {						 \
 	changed = true;						 \
 }								 \
 
+u64 hdspe_tco_status_bits(struct hdspe* hdspe)
+{
+	/* TCO1 without the LTC offset, TCO2 video input frame rate */
+	u32 tco1 = hdspe_read_tco(hdspe, 1) & ~0x7F7F0000;
+	u32 tco2 = hdspe_read_tco(hdspe, 2) & 0x78000000;
+	return ((u64)tco2 << 32) | tco1;
+}
+
 bool hdspe_tco_notify_status_change(struct hdspe* hdspe)
 {
 	bool changed = false;
 	struct hdspe_tco_status o = hdspe->tco->last_status;
 	struct hdspe_tco_status n;
 	hdspe_tco_read_status1(hdspe, &n);
+	hdspe_tco_read_status2(hdspe, &n);
 
 	CHECK_STATUS_CHANGE(ltc_valid);
 	CHECK_STATUS_CHANGE(ltc_in_fps);